@@ -0,0 +1,181 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/arena.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+
+#include "transport_catalog.pb.h"
+
+
+//Независимо загружаемые части базы
+enum class CatalogSection : uint32_t {
+    Stats,       //Остановки, автобусы и их маршруты - нужны всем запросам
+    YellowPages, //Компании, рубрики, расписания
+    Router,      //Граф и таблица маршрутизатора
+    Render,      //Настройки, координаты и готовая карта
+    Count
+};
+
+
+//Загруженная база: сообщение целиком в арене protobuf и живёт, пока живёт держатель.
+//Parser, RouteFinder и MapRender ссылаются на его части, а не копируют их.
+//Файл разбит на секции - каждая это TransportCatalog только со своими полями.
+//Секция подгружается при первом обращении и дописывается в то же сообщение
+class CatalogHolder {
+
+public:
+
+    explicit CatalogHolder(const std::string& filename) 
+        : file(filename, std::ios::binary), arena(arenaOptions()) 
+    {
+        if (file.is_open() == false)
+            throw std::runtime_error("Can't open database " + filename);
+
+        Header header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) 
+            || std::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version 
+            || header.sectionCount != sections.size())
+            throw std::runtime_error("Broken database " + filename);
+        if (!file.read(reinterpret_cast<char*>(sections.data()), sizeof(SectionEntry) * sections.size()))
+            throw std::runtime_error("Broken database " + filename);
+
+        catalog = google::protobuf::Arena::CreateMessage<Database::TransportCatalog>(&arena);
+        name = filename;
+    }
+
+    CatalogHolder(const CatalogHolder&) = delete;
+    CatalogHolder& operator=(const CatalogHolder&) = delete;
+
+
+    //Читает секцию, если её ещё нет. true - секция загружена только что
+    bool load(CatalogSection section) {
+        if (loaded[static_cast<size_t>(section)])
+            return false;
+        read(section, *catalog);
+        return true;
+    }
+
+
+    //Секция в собственной арене, которая живёт только на время consume - для данных, которые при загрузке
+    //копируются в свои структуры и дальше не нужны (граф и таблица маршрутизатора).
+    //Блоки арены крупные, поэтому после освобождения память возвращается системе, а не остаётся в куче
+    template <typename Consume>
+    void loadSeparately(CatalogSection section, Consume consume) {
+        if (loaded[static_cast<size_t>(section)])
+            return;
+        google::protobuf::Arena sectionArena(arenaOptions());
+        auto message = google::protobuf::Arena::CreateMessage<Database::TransportCatalog>(&sectionArena);
+        read(section, *message);
+        consume(*message);
+    }
+
+    Database::TransportCatalog& get() { return *catalog; }
+    const Database::TransportCatalog& get() const { return *catalog; }
+
+
+    //Раскладывает db по секциям: заголовок, таблица смещений, секции подряд. db при этом опустошается
+    static void Write(Database::TransportCatalog& db, std::ostream& os) {
+        std::array<std::string, SectionCount> bytes;
+        for (size_t i = 0; i < SectionCount; ++i) {
+            Database::TransportCatalog part;
+            db.GetReflection()->SwapFields(&db, &part, sectionFields(static_cast<CatalogSection>(i)));
+            bytes[i] = part.SerializeAsString();
+        }
+
+        Header header;
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        std::array<SectionEntry, SectionCount> entries{};
+        uint64_t offset = sizeof(Header) + sizeof(entries);
+        for (size_t i = 0; i < SectionCount; ++i) {
+            entries[i].offset = offset;
+            entries[i].size = bytes[i].size();
+            offset += bytes[i].size();
+        }
+
+        os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        os.write(reinterpret_cast<const char*>(entries.data()), sizeof(entries));
+        for (const auto& b : bytes)
+            os.write(b.data(), b.size());
+    }
+
+private:
+
+    void read(CatalogSection section, Database::TransportCatalog& message) {
+        const auto& entry = sections[static_cast<size_t>(section)];
+        file.clear();
+        file.seekg(entry.offset);
+        google::protobuf::io::IstreamInputStream stream(&file); //Файл читается кусками, целиком в памяти не лежит
+        if (!file || message.MergeFromBoundedZeroCopyStream(&stream, static_cast<int>(entry.size)) == false)
+            throw std::runtime_error("Broken database section in " + name);
+        loaded[static_cast<size_t>(section)] = true;
+    }
+
+
+    static constexpr size_t SectionCount = static_cast<size_t>(CatalogSection::Count);
+    static constexpr char Magic[4] = {'T', 'C', 'D', 'B'};
+    static constexpr uint32_t Version = 1;
+
+    struct Header {
+        char magic[4];
+        uint32_t version = Version;
+        uint32_t sectionCount = SectionCount;
+    };
+
+    struct SectionEntry {
+        uint64_t offset = 0;
+        uint64_t size = 0;
+    };
+
+
+    static std::vector<const google::protobuf::FieldDescriptor*> sectionFields(CatalogSection section) {
+        using DB = Database::TransportCatalog;
+        std::vector<int> numbers;
+        switch (section) {
+        case CatalogSection::Stats:
+            numbers = {DB::kStopNamesFieldNumber, DB::kStopStatsFieldNumber, DB::kBusNamesFieldNumber,
+                DB::kBusStatsFieldNumber, DB::kBusInfoFieldNumber};
+            break;
+        case CatalogSection::YellowPages:
+            numbers = {DB::kYellowPagesFieldNumber, DB::kCompanySchedulesFieldNumber};
+            break;
+        case CatalogSection::Router:
+            numbers = {DB::kBusWaitTimeFieldNumber, DB::kRouterFieldNumber};
+            break;
+        case CatalogSection::Render:
+            numbers = {DB::kStopCoordsFieldNumber, DB::kCompanyCoordsFieldNumber, DB::kBusColorsFieldNumber,
+                DB::kRenderSettingsFieldNumber, DB::kRenderedMapFieldNumber, DB::kRenderedRouteBaseFieldNumber,
+                DB::kSvgStylesFieldNumber};
+            break;
+        case CatalogSection::Count:
+            break;
+        }
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        for (int number : numbers)
+            fields.push_back(DB::descriptor()->FindFieldByNumber(number));
+        return fields;
+    }
+
+
+    static google::protobuf::ArenaOptions arenaOptions() { //По умолчанию блоки не больше 8 КБ - для базы в мегабайты это тысячи блоков
+        google::protobuf::ArenaOptions options;
+        options.start_block_size = 64 * 1024;
+        options.max_block_size = 4 * 1024 * 1024;
+        return options;
+    }
+
+    std::ifstream file; //Открыт, пока нужен: секции дочитываются по запросу
+    std::string name;
+    std::array<SectionEntry, SectionCount> sections;
+    std::array<bool, SectionCount> loaded{};
+    google::protobuf::Arena arena;
+    Database::TransportCatalog* catalog;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+
+struct FragmentKey { //Объект, к которому относится кусок (маршрут автобуса, остановка), и диапазон позиций
+    const void* object;
+    uint32_t first;
+    uint32_t last;
+
+    bool operator==(const FragmentKey& other) const {
+        return object == other.object && first == other.first && last == other.last;
+    }
+};
+
+
+struct FragmentKeyHasher {
+    size_t operator()(const FragmentKey& key) const {
+        const size_t h = std::hash<const void*>{}(key.object);
+        return h * 1000003 + (static_cast<uint64_t>(key.first) << 32 | key.last);
+    }
+};
+
+
+//Готовые куски svg с ограничением по памяти и вытеснением давно не использованных (LRU).
+//Кусок отдаётся через shared_ptr, поэтому вытеснение не портит документы, которые его ещё держат
+template <typename Key = FragmentKey, typename Hasher = FragmentKeyHasher>
+class FragmentCache {
+
+public:
+
+    using Fragment = std::shared_ptr<const std::string>;
+
+    explicit FragmentCache(size_t maxBytes) : maxBytes(maxBytes) {}
+
+    template <typename Render>
+    Fragment get(const Key& key, Render render) { //Рендер идёт без блокировки: потоки с разными промахами не ждут друг друга
+        if (auto fragment = find(key))
+            return fragment;
+
+        auto fragment = std::make_shared<const std::string>(render());
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto it = index.find(key); it != index.end()) { //Тот же кусок успел построить другой поток - берём его
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+        entries.emplace_front(key, fragment);
+        index[key] = entries.begin();
+        totalBytes += fragment->size();
+        evict();
+        return fragment;
+    }
+
+private:
+
+    Fragment find(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+            return nullptr;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void evict() {
+        while (totalBytes > maxBytes && entries.size() > 1) {
+            totalBytes -= entries.back().second->size();
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    using Entry = std::pair<Key, Fragment>;
+
+    size_t maxBytes;
+    size_t totalBytes = 0;
+    std::list<Entry> entries; //Спереди - недавно использованные
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hasher> index;
+    std::mutex mutex;
+};
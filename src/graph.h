@@ -4,7 +4,10 @@
 #include "graph.pb.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <vector>
 
@@ -13,6 +16,24 @@ namespace Graph {
   using VertexId = size_t;
   using EdgeId = size_t;
 
+  //Массив простых значений в базе хранится как есть, байтами: загрузка - одно копирование без разбора по элементам
+  template <typename T>
+  void WriteFlat(std::string& bytes, const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    bytes.assign(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+  }
+
+  template <typename T>
+  std::vector<T> ReadFlat(const std::string& bytes) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (bytes.size() % sizeof(T) != 0)
+      throw std::runtime_error("Broken flat array in database: size is not a multiple of the element");
+    std::vector<T> values(bytes.size() / sizeof(T));
+    if (values.empty() == false)
+      std::memcpy(values.data(), bytes.data(), values.size() * sizeof(T));
+    return values;
+  }
+
   template <typename Weight>
   struct Edge {
     VertexId from;
@@ -77,4 +98,47 @@ namespace Graph {
     return {std::begin(edges), std::end(edges)};
   }
 
+  template <typename Weight>
+  void DirectedWeightedGraph<Weight>::Serialize(GraphProto::DirectedWeightedGraph& proto) const {
+    proto.set_vertex_count(incidence_lists_.size());
+    WriteFlat(*proto.mutable_edges(), edges_);
+
+    std::vector<EdgeId> offsets; //Списки смежности подряд: рёбра вершины v - incidence[offsets[v] .. offsets[v + 1])
+    std::vector<EdgeId> incidence;
+    offsets.reserve(incidence_lists_.size() + 1);
+    incidence.reserve(edges_.size());
+    offsets.push_back(0);
+    for (const auto& list : incidence_lists_) {
+      incidence.insert(incidence.end(), list.begin(), list.end());
+      offsets.push_back(incidence.size());
+    }
+    WriteFlat(*proto.mutable_incidence_offsets(), offsets);
+    WriteFlat(*proto.mutable_incidence_edges(), incidence);
+  }
+
+  template <typename Weight>
+  DirectedWeightedGraph<Weight> DirectedWeightedGraph<Weight>::Deserialize(const GraphProto::DirectedWeightedGraph& proto) {
+    DirectedWeightedGraph graph(proto.vertex_count());
+    graph.edges_ = ReadFlat<Edge<Weight>>(proto.edges());
+
+    const auto offsets = ReadFlat<EdgeId>(proto.incidence_offsets());
+    const auto incidence = ReadFlat<EdgeId>(proto.incidence_edges());
+
+    //База могла оказаться обрезанной или от другой версии - проверяем, прежде чем индексировать
+    const size_t vertexCount = graph.incidence_lists_.size();
+    bool valid = offsets.size() == vertexCount + 1 && offsets.front() == 0 && offsets.back() == incidence.size();
+    for (size_t i = 1; valid && i < offsets.size(); ++i)
+      valid = offsets[i - 1] <= offsets[i];
+    for (size_t i = 0; valid && i < incidence.size(); ++i)
+      valid = incidence[i] < graph.edges_.size();
+    for (size_t i = 0; valid && i < graph.edges_.size(); ++i)
+      valid = graph.edges_[i].from < vertexCount && graph.edges_[i].to < vertexCount;
+    if (valid == false)
+      throw std::runtime_error("Broken graph in database: incidence lists don't match vertices and edges");
+
+    for (VertexId vertex = 0; vertex < graph.incidence_lists_.size(); ++vertex)
+      graph.incidence_lists_[vertex].assign(incidence.begin() + offsets[vertex], incidence.begin() + offsets[vertex + 1]);
+    return graph;
+  }
+
 }
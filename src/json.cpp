@@ -1,157 +1,686 @@
 #include "json.h"
+#include "jsonindex.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <tuple>
 
 using namespace std;
 
 namespace Json {
 
-    Document::Document(Node root) : root(move(root)) {
+    static_assert(is_nothrow_move_constructible_v<Node>, "Node перемещается между стеком построителя и ареной");
+
+    Document::Document(Node root) : ownedRoot(make_unique<Node>(move(root))), root(ownedRoot.get()) {
+    }
+
+    Document::Document(unique_ptr<pmr::monotonic_buffer_resource> arena, Node rootNode) : arena(move(arena)) {
+        void* place = this->arena->allocate(sizeof(Node), alignof(Node));
+        root = new (place) Node(move(rootNode)); //Деструкторы узлов не вызываются, память уходит вместе с ареной
     }
 
     const Node& Document::GetRoot() const {
-        return root;
+        return *root;
     }
 
-    Node LoadNode(istream& input);
 
+    Node& Dict::operator[](string_view key) {
+        auto it = items.begin() + (lowerBound(key) - items.cbegin());
+        if (it == items.end() || it->first != key)
+            it = items.emplace(it, piecewise_construct, forward_as_tuple(key), forward_as_tuple());
+        return it->second;
+    }
+
+
+    namespace {
+
+        class BufferReader { //Вторая стадия: идёт по индексу токенов и отдаёт события обработчику
+        public:
+            BufferReader(string_view buffer, Handler& handler)
+                : begin(buffer.data()), end(buffer.data() + buffer.size()), handler(handler), index(BuildStructuralIndex(buffer)) {
+            }
+
+            //Поток читается частями: индекс строится по мере чтения, а прочитанное отбрасывается,
+            //так что в памяти лежит только ещё не разобранный хвост, а не весь документ
+            BufferReader(istream& input, Handler& handler) : input(&input), handler(handler) {
+            }
+
+            void ReadDocument() {
+                ReadValue();
+                if (Fill(), token != index.size())
+                    throw ParsingError("Unexpected data after the document end");
+            }
+
+        private:
+            static constexpr size_t CHUNK_SIZE = 1 << 16;
+
+            istream* input = nullptr;
+            string storage; //Непрочитанная часть потока
+            StructuralIndexer indexer;
+            size_t scanned = 0; //Граница целых проиндексированных блоков storage
+            size_t indexed = 0; //Токены до этой позиции уже в index, включая неполный последний блок
+            vector<uint32_t> found;
+            bool inputEnded = false;
+
+            const char* begin = nullptr;
+            const char* end = nullptr;
+            Handler& handler;
+            vector<uint32_t> index;
+            size_t token = 0;
+            string scratch; //Только для строк с экранированием, остальные отдаются видом на буфер
+
+
+            //Токен берётся, только когда в индексе есть следующий: тогда строка или число перед ним прочитаны целиком
+            void Fill() {
+                while (input && inputEnded == false && index.size() < token + 2)
+                    ReadChunk();
+            }
+
+
+            void ReadChunk() {
+                size_t consumed = scanned; //Неполный блок в конце ещё понадобится целиком
+                if (token < index.size())
+                    consumed = min<size_t>(index[token], scanned);
+                storage.erase(0, consumed);
+                for (size_t i = token; i < index.size(); ++i)
+                    index[i] -= consumed;
+                index.erase(index.begin(), index.begin() + token);
+                token = 0;
+                scanned -= consumed;
+                indexed -= consumed;
+
+                const size_t size = storage.size();
+                storage.resize(size + CHUNK_SIZE);
+                const size_t received = ReadAvailable(storage.data() + size, CHUNK_SIZE);
+                storage.resize(size + received);
+                inputEnded = received == 0;
+                if (storage.size() >= UINT32_MAX)
+                    throw ParsingError("Token is too large for the structural index");
+
+                found.clear();
+                const string_view unscanned = string_view(storage).substr(scanned);
+                scanned += indexer.Scan(unscanned, static_cast<uint32_t>(scanned), inputEnded, found);
+                if (scanned < storage.size()) { //Неполный блок сканируем копией состояния, с приходом данных он пересканируется.
+                    StructuralIndexer probe = indexer; //Позиции токенов зависят только от байт до них, так что найденные не изменятся
+                    probe.Scan(string_view(storage).substr(scanned), static_cast<uint32_t>(scanned), true, found);
+                }
+                for (uint32_t pos : found)
+                    if (pos >= indexed)
+                        index.push_back(pos);
+                indexed = storage.size();
+
+                begin = storage.data();
+                end = storage.data() + storage.size();
+            }
 
-    Node LoadArray(istream& input) {
-        vector<Node> result;
 
-        for (char c; input >> c && c != ']'; ) {
-            if (c != ',') {
-                input.putback(c);
+            //Ждёт хотя бы один байт, дальше берёт только то, что уже пришло: из канала запросы
+            //разбираются по мере поступления, а не после заполнения целого блока
+            size_t ReadAvailable(char* out, size_t size) {
+                if (input->peek() == char_traits<char>::eof())
+                    return 0;
+                streamsize received = input->readsome(out, size);
+                if (received == 0) { //Поток без своего буфера (например, cin в синхроне с stdio)
+                    input->read(out, 1);
+                    received = input->gcount();
+                }
+                return static_cast<size_t>(received);
             }
-            result.push_back(LoadNode(input));
+
+
+            char NextToken() {
+                Fill();
+                if (token == index.size())
+                    throw ParsingError("Unexpected end of the document");
+                return begin[index[token]];
+            }
+
+
+            const char* TakeToken() {
+                NextToken();
+                return begin + index[token++];
+            }
+
+
+            void Expect(char c) {
+                if (NextToken() != c)
+                    throw ParsingError(string("Expected '") + c + "'");
+                ++token;
+            }
+
+
+            void ExpectWord(const char* pos, string_view word) const {
+                if (static_cast<size_t>(end - pos) < word.size() || string_view(pos, word.size()) != word)
+                    throw ParsingError("Unknown literal");
+                ExpectScalarEnd(pos + word.size());
+            }
+
+
+            void ExpectScalarEnd(const char* pos) const { //Число или литерал должны заканчиваться разделителем
+                if (pos != end && strchr(" \n\r\t,:]}", *pos) == nullptr)
+                    throw ParsingError("Unexpected character after scalar value");
+            }
+
+
+            void ReadValue() {
+                const char* pos = TakeToken();
+                switch (*pos) {
+                    case '[':
+                        ReadArray();
+                        break;
+                    case '{':
+                        ReadDict();
+                        break;
+                    case '"':
+                        handler.String(ReadString(pos));
+                        break;
+                    case 't':
+                        ExpectWord(pos, "true");
+                        handler.Bool(true);
+                        break;
+                    case 'f':
+                        ExpectWord(pos, "false");
+                        handler.Bool(false);
+                        break;
+                    case 'n':
+                        ExpectWord(pos, "null");
+                        handler.Null();
+                        break;
+                    default:
+                        ReadNumber(pos);
+                }
+            }
+
+
+            void ReadArray() {
+                handler.StartArray();
+                if (NextToken() == ']') {
+                    ++token;
+                    handler.EndArray();
+                    return;
+                }
+                while (true) {
+                    ReadValue();
+                    char c = *TakeToken();
+                    if (c == ']')
+                        break;
+                    if (c != ',')
+                        throw ParsingError("Expected ',' or ']' in array");
+                }
+                handler.EndArray();
+            }
+
+
+            void ReadDict() {
+                handler.StartObject();
+                if (NextToken() == '}') {
+                    ++token;
+                    handler.EndObject();
+                    return;
+                }
+                while (true) {
+                    const char* pos = TakeToken();
+                    if (*pos != '"')
+                        throw ParsingError("Expected string key in object");
+                    handler.Key(ReadString(pos));
+                    Expect(':');
+                    ReadValue();
+                    char c = *TakeToken();
+                    if (c == '}')
+                        break;
+                    if (c != ',')
+                        throw ParsingError("Expected ',' or '}' in object");
+                }
+                handler.EndObject();
+            }
+
+
+            void ReadNumber(const char* pos) {
+                const char* start = pos;
+                bool isInteger = true;
+                if (pos != end && *pos == '-')
+                    ++pos;
+                SkipDigits(pos);
+                if (pos != end && *pos == '.') {
+                    isInteger = false;
+                    ++pos;
+                    SkipDigits(pos);
+                }
+                if (pos != end && (*pos == 'e' || *pos == 'E')) {
+                    isInteger = false;
+                    ++pos;
+                    if (pos != end && (*pos == '+' || *pos == '-'))
+                        ++pos;
+                    SkipDigits(pos);
+                }
+
+                ExpectScalarEnd(pos);
+
+                if (isInteger) {
+                    int intValue = 0;
+                    auto [ptr, ec] = from_chars(start, pos, intValue);
+                    if (ec == errc{} && ptr == pos) {
+                        handler.Int(intValue);
+                        return;
+                    }
+                }
+                double doubleValue = 0; //Целые, не поместившиеся в int, тоже читаем как double
+                auto [ptr, ec] = from_chars(start, pos, doubleValue);
+                if (ec != errc{} || ptr != pos)
+                    throw ParsingError("Invalid number");
+                handler.Double(doubleValue);
+            }
+
+
+            void SkipDigits(const char*& pos) const {
+                while (pos != end && *pos >= '0' && *pos <= '9')
+                    ++pos;
+            }
+
+
+            string_view ReadString(const char* pos) {
+                const char* start = ++pos;
+                const char* quote = static_cast<const char*>(memchr(start, '"', end - start));
+                if (quote == nullptr)
+                    throw ParsingError("Unterminated string");
+                pos = static_cast<const char*>(memchr(start, '\\', quote - start));
+                if (pos == nullptr) //Быстрый путь: строка без экранирования не копируется
+                    return string_view(start, quote - start);
+
+                scratch.assign(start, pos);
+                while (true) {
+                    if (pos == end)
+                        throw ParsingError("Unterminated string");
+                    char c = *pos++;
+                    if (c == '"')
+                        break;
+                    if (c != '\\') {
+                        scratch.push_back(c);
+                        continue;
+                    }
+                    if (pos == end)
+                        throw ParsingError("Unterminated string");
+                    switch (char escaped = *pos++) {
+                        case '"': scratch.push_back('"'); break;
+                        case '\\': scratch.push_back('\\'); break;
+                        case '/': scratch.push_back('/'); break;
+                        case 'b': scratch.push_back('\b'); break;
+                        case 'f': scratch.push_back('\f'); break;
+                        case 'n': scratch.push_back('\n'); break;
+                        case 'r': scratch.push_back('\r'); break;
+                        case 't': scratch.push_back('\t'); break;
+                        case 'u': AppendCodePoint(scratch, ReadCodePoint(pos)); break;
+                        default:
+                            throw ParsingError(string("Unknown escape sequence \\") + escaped);
+                    }
+                }
+                return scratch;
+            }
+
+
+            uint32_t ReadHex4(const char*& pos) const {
+                if (end - pos < 4)
+                    throw ParsingError("Invalid unicode escape");
+                uint32_t value = 0;
+                auto [ptr, ec] = from_chars(pos, pos + 4, value, 16);
+                if (ec != errc{} || ptr != pos + 4)
+                    throw ParsingError("Invalid unicode escape");
+                pos += 4;
+                return value;
+            }
+
+
+            uint32_t ReadCodePoint(const char*& pos) const {
+                uint32_t codePoint = ReadHex4(pos);
+                if (codePoint >= 0xD800 && codePoint <= 0xDBFF) { //Суррогатная пара
+                    if (end - pos < 2 || pos[0] != '\\' || pos[1] != 'u')
+                        throw ParsingError("Unpaired surrogate in unicode escape");
+                    pos += 2;
+                    uint32_t low = ReadHex4(pos);
+                    if (low < 0xDC00 || low > 0xDFFF)
+                        throw ParsingError("Unpaired surrogate in unicode escape");
+                    codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                }
+                return codePoint;
+            }
+
+            static void AppendCodePoint(string& out, uint32_t codePoint) {
+                if (codePoint < 0x80)
+                    out.push_back(static_cast<char>(codePoint));
+                else if (codePoint < 0x800) {
+                    out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+                    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+                }
+                else if (codePoint < 0x10000) {
+                    out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+                    out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+                }
+                else {
+                    out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+                    out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+                }
+            }
+        };
+
+
+        void AppendEscapedText(string& buffer, string_view value) { //Один проход: копируем куски между спецсимволами
+            size_t written = 0;
+            for (size_t i = 0; i < value.size(); ++i) {
+                const unsigned char c = value[i];
+                if (c != '"' && c != '\\' && c >= 0x20)
+                    continue;
+                buffer.append(value.data() + written, i - written);
+                written = i + 1;
+                switch (c) {
+                    case '"': buffer += "\\\""; break;
+                    case '\\': buffer += "\\\\"; break;
+                    case '\n': buffer += "\\n"; break;
+                    case '\r': buffer += "\\r"; break;
+                    case '\t': buffer += "\\t"; break;
+                    case '\b': buffer += "\\b"; break;
+                    case '\f': buffer += "\\f"; break;
+                    default: {
+                        static const char hex[] = "0123456789abcdef";
+                        const char unicode[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                        buffer.append(unicode, sizeof(unicode));
+                    }
+                }
+            }
+            buffer.append(value.data() + written, value.size() - written);
         }
 
-        return Node(move(result));
     }
 
 
-    Node LoadNumber(istream& input) {
-        
-        int signValue = 1; //������ ���� � �������� ����������, � �������� ��������� ��������� �� �������� -1 ��� 1
-        if (input.peek() == '-') {
-            input.ignore();
-            signValue = -1;
-        }
+    NodeBuilder::NodeBuilder(pmr::memory_resource* resource) : resource(resource) {
+    }
 
-        int intValue = 0; //�� ������� ���� ����, ������� ������� :)
-        while (isdigit(input.peek())) {
-            intValue *= 10;
-            intValue += input.get() - '0';
-        }
+    void NodeBuilder::StartObject() {
+        stack.push_back({ true, values.size(), keys.size() });
+    }
 
-        if (input.peek() != '.') 
-            return Node(signValue * intValue); //������������� �����, ������������� ������
-        
-        input.ignore(); //���������� �����������
+    void NodeBuilder::Key(string_view key) {
+        keys.emplace_back(key, resource);
+    }
 
-        double doubleValue = intValue; //�������� ����� ������������� �����
-        double coef = 0.1; 
-        while (isdigit(input.peek())) {
-            doubleValue += (input.get() - '0') * coef;
-            coef *= 0.1; //������ ����� ������ ���� � 10 ��� ������ ��������������
+    void NodeBuilder::EndObject() { //Как у map::emplace - из повторяющихся ключей остаётся первый
+        const Frame frame = stack.back();
+        stack.pop_back();
+
+        order.resize(keys.size() - frame.firstKey);
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = frame.firstKey + i;
+        sort(order.begin(), order.end(), [this](size_t lhs, size_t rhs) {
+            return keys[lhs] < keys[rhs] || (keys[lhs] == keys[rhs] && lhs < rhs);
+        });
+
+        Dict object(resource);
+        object.items.reserve(order.size());
+        for (size_t i : order) {
+            if (object.items.empty() == false && object.items.back().first == keys[i])
+                continue;
+            object.items.emplace_back(move(keys[i]), move(values[frame.firstValue + i - frame.firstKey]));
         }
-        return Node(signValue * doubleValue);
+        keys.resize(frame.firstKey);
+        values.resize(frame.firstValue);
+        AddValue(Node(move(object)));
+    }
+
+    void NodeBuilder::StartArray() {
+        stack.push_back({ false, values.size(), keys.size() });
     }
 
+    void NodeBuilder::EndArray() {
+        const Frame frame = stack.back();
+        stack.pop_back();
 
-    Node LoadString(istream& input) {
-        string line;
-        getline(input, line, '"');
-        return Node(move(line));
+        Array array(resource);
+        array.reserve(values.size() - frame.firstValue);
+        for (size_t i = frame.firstValue; i < values.size(); ++i)
+            array.push_back(move(values[i]));
+        values.resize(frame.firstValue);
+        AddValue(Node(move(array)));
     }
 
+    void NodeBuilder::String(string_view value) {
+        AddValue(Node(value, resource));
+    }
 
-    Node LoadDict(istream& input) {
-        map<string, Node> result;
+    void NodeBuilder::Int(int value) {
+        AddValue(Node(value));
+    }
 
-        for (char c; input >> c && c != '}'; ) {
-            if (c == ',') {
-                input >> c;
-            }
+    void NodeBuilder::Double(double value) {
+        AddValue(Node(value));
+    }
 
-            string key = LoadString(input).AsString();
-            input >> c;
-            result.emplace(move(key), LoadNode(input));
-        }
+    void NodeBuilder::Bool(bool value) {
+        AddValue(Node(value));
+    }
 
-        return Node(move(result));
+    void NodeBuilder::Null() {
+        AddValue(Node(nullptr));
     }
 
+    bool NodeBuilder::IsComplete() const {
+        return stack.empty() && root.empty() == false;
+    }
 
-    Node LoadBool(istream& input) {
-        bool result = (input.peek() == 't'); //���� ������ true, ������ ����� �������������� t ��� f - ��� ���������� ���� �� ����� �������
-        while (isalpha(input.peek()))  
-            input.get();    //���������� ����������� ����� ��� ���� true, ���� false
-        return Node(result);
+    Node NodeBuilder::TakeRoot() {
+        Node node = move(root.back());
+        root.clear();
+        return node;
     }
 
+    void NodeBuilder::AddValue(Node node) {
+        if (stack.empty())
+            root.push_back(move(node));
+        else
+            values.push_back(move(node));
+    }
 
-    Node LoadNode(istream& input) {
-        char c;
-        input >> c;
 
-        if (c == '[') {
-            return LoadArray(input);
-        }
-        else if (c == '{') {
-            return LoadDict(input);
-        }
-        else if (c == '"') {
-            return LoadString(input);
-        }
-        else if (c == 't' || c == 'f') {
-            input.putback(c);
-            return LoadBool(input);
-        }
-        else {
-            input.putback(c);
-            return LoadNumber(input);
+    void Parse(string_view buffer, Handler& handler) {
+        BufferReader(buffer, handler).ReadDocument();
+    }
+
+
+    void Parse(istream& input, Handler& handler) {
+        BufferReader(input, handler).ReadDocument();
+    }
+
+
+    Document Load(string_view buffer) {
+        auto arena = make_unique<pmr::monotonic_buffer_resource>(max<size_t>(buffer.size(), 4096)); //Узлов примерно столько же байт, сколько текста
+        NodeBuilder builder(arena.get());
+        Parse(buffer, builder);
+        return Document(move(arena), builder.TakeRoot());
+    }
+
+
+    Document Load(istream& input) { //Размер текста заранее неизвестен, арена растёт блоками
+        auto arena = make_unique<pmr::monotonic_buffer_resource>(1 << 16);
+        NodeBuilder builder(arena.get());
+        Parse(input, builder);
+        return Document(move(arena), builder.TakeRoot());
+    }
+
+
+    string EscapeString(string_view value) {
+        string result;
+        AppendEscapedText(result, value);
+        return result;
+    }
+
+
+    Writer::Writer(int precision) : precision(precision) {
+    }
+
+    Writer::Writer(ostream& output, int precision) : output(&output), precision(precision) {
+    }
+
+    Writer& Writer::StartObject() {
+        BeforeValue();
+        buffer += "{\n";
+        firstElement.push_back(true);
+        return *this;
+    }
+
+    Writer& Writer::Key(string_view key) {
+        if (firstElement.back() == false)
+            buffer += ",\n";
+        firstElement.back() = false;
+        AppendEscaped(key);
+        buffer += ':';
+        afterKey = true;
+        return *this;
+    }
+
+    Writer& Writer::EndObject() {
+        buffer += "\n}";
+        firstElement.pop_back();
+        return *this;
+    }
+
+    Writer& Writer::StartArray() {
+        BeforeValue();
+        buffer += "[\n";
+        firstElement.push_back(true);
+        return *this;
+    }
+
+    Writer& Writer::EndArray() {
+        buffer += "\n]";
+        firstElement.pop_back();
+        return *this;
+    }
+
+    Writer& Writer::String(string_view value) {
+        BeforeValue();
+        AppendEscaped(value);
+        return *this;
+    }
+
+    Writer& Writer::String(const Rope& value) {
+        static constexpr size_t DirectWriteSize = 4096;
+        BeforeValue();
+        buffer += '"';
+        for (const auto& segment : value.Segments()) {
+            if (segment.escaped == false)
+                AppendEscapedText(buffer, segment.text);
+            else if (output != nullptr && segment.text.size() >= DirectWriteSize) {
+                Flush();
+                output->write(segment.text.data(), segment.text.size());
+            }
+            else
+                buffer += segment.text;
         }
+        buffer += '"';
+        return *this;
+    }
+
+    Writer& Writer::Int(int value) {
+        BeforeValue();
+        char chars[16];
+        auto [ptr, ec] = to_chars(begin(chars), end(chars), value);
+        buffer.append(chars, ptr);
+        return *this;
     }
 
+    Writer& Writer::Double(double value) { //Как ostream << setprecision(precision) << value
+        BeforeValue();
+        char chars[64];
+        auto [ptr, ec] = to_chars(begin(chars), end(chars), value, chars_format::general, precision);
+        buffer.append(chars, ptr);
+        return *this;
+    }
 
-    Document Load(istream& input) {
-        return Document{ LoadNode(input) };
+    Writer& Writer::Number(double value) {
+        if (value == round(value) && value >= numeric_limits<int>::min() && value <= numeric_limits<int>::max())
+            return Int(static_cast<int>(value));
+        return Double(value);
     }
 
+    Writer& Writer::Bool(bool value) {
+        BeforeValue();
+        buffer += value ? "true" : "false";
+        return *this;
+    }
 
-    std::ostream& Node::PushToStream(std::ostream& os) const {
-        if (holds_alternative<int>(*this)) 
-            os << AsInt();
-        else if (holds_alternative<double>(*this)) 
-            os  << AsDouble();
-        else if (holds_alternative<bool>(*this)) 
-            os << (AsBool() ? "true" : "false");
-        else if (holds_alternative<string>(*this)) 
-            os << '"' << AsString() << '"';
-        else if (holds_alternative<vector<Node>>(*this)) {
-            const auto& nodes = AsArray();
-            os << "[\n";
-            bool firstElement = true;
-            for (const auto& node : nodes) {
-                if (!firstElement) 
-                    os << ",\n";
-                firstElement = false;
-                os << node;
-            }
-            os << "\n]";
+    Writer& Writer::Null() {
+        BeforeValue();
+        buffer += "null";
+        return *this;
+    }
+
+    Writer& Writer::Value(const Node& node) {
+        if (node.IsNull())
+            return Null();
+        else if (node.hasString())
+            return String(node.AsString());
+        else if (node.IsInt())
+            return Int(node.AsInt());
+        else if (node.IsDouble())
+            return Double(node.AsDouble());
+        else if (node.IsBool())
+            return Bool(node.AsBool());
+        else if (node.IsArray()) {
+            StartArray();
+            for (const auto& element : node.AsArray())
+                Value(element);
+            return EndArray();
         }
-        else if (holds_alternative<map<string, Node>>(*this)) {
-            const auto& nodes_map = AsMap();
-            os << "{\n";
-            bool firstElement = true;
-            for (const auto& [key, node] : nodes_map) {
-                if (!firstElement) 
-                    os << ",\n";
-                firstElement = false;
-                os << '"' << key << "\":" << node;
-            }
-            os << "\n}";
+        StartObject();
+        for (const auto& [key, element] : node.AsMap())
+            Key(key).Value(element);
+        return EndObject();
+    }
+
+    const string& Writer::GetBuffer() const {
+        return buffer;
+    }
+
+    void Writer::Clear() {
+        buffer.clear();
+    }
+
+    void Writer::Flush() {
+        if (output == nullptr)
+            return;
+        output->write(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+
+    void Writer::BeforeValue() {
+        if (afterKey) {
+            afterKey = false;
+            return;
         }
-        return os;
+        if (firstElement.empty())
+            return;
+        if (firstElement.back() == false)
+            buffer += ",\n";
+        firstElement.back() = false;
+    }
+
+    void Writer::AppendEscaped(string_view value) {
+        buffer += '"';
+        AppendEscapedText(buffer, value);
+        buffer += '"';
+    }
+
+
+    std::ostream& Node::PushToStream(std::ostream& os) const {
+        Writer writer(static_cast<int>(os.precision()));
+        writer.Value(*this);
+        const auto& buffer = writer.GetBuffer();
+        return os.write(buffer.data(), buffer.size());
     }
 
 }
@@ -159,4 +688,4 @@ namespace Json {
 
 ostream& operator<<(ostream& os, const Json::Node& node) {
     return node.PushToStream(os);
-}
\ No newline at end of file
+}
@@ -1,34 +1,101 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <istream>
-#include <map>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 namespace Json {
 
-    class Node : std::variant<std::vector<Node>,
-        std::map<std::string, Node>,
+    class ParsingError : public std::runtime_error {
+    public:
+        using runtime_error::runtime_error;
+    };
+
+    class Node;
+
+    using Array = std::pmr::vector<Node>;
+
+    class Dict { //       
+    public:
+        using Item = std::pair<std::pmr::string, Node>;
+        using Items = std::pmr::vector<Item>;
+
+        Dict() = default;
+        explicit Dict(std::pmr::memory_resource* resource) : items(resource) {}
+
+        const Node& at(std::string_view key) const;
+        size_t count(std::string_view key) const;
+        Items::const_iterator find(std::string_view key) const;
+
+        Node& operator[](std::string_view key); //   ,   
+
+        Items::const_iterator begin() const { return items.begin(); }
+        Items::const_iterator end() const { return items.end(); }
+        size_t size() const { return items.size(); }
+        bool empty() const { return items.empty(); }
+
+    private:
+        friend class NodeBuilder;
+
+        Items::const_iterator lowerBound(std::string_view key) const;
+
+        Items items;
+    };
+
+    class Node : std::variant<Array,
+        Dict,
         int,
         bool,
         double,
-        std::string> {
+        std::pmr::string,
+        std::nullptr_t> {
 
     public:
 
         using variant::variant;
 
+        Node() = default;
+        Node(std::string_view value, std::pmr::memory_resource* resource = std::pmr::get_default_resource()) 
+            : variant(std::pmr::string(value, resource)) {
+        }
+
+        bool IsNull() const {
+            return std::holds_alternative<std::nullptr_t>(*this);
+        }
+
+        bool IsInt() const {
+            return std::holds_alternative<int>(*this);
+        }
+
+        bool IsDouble() const {
+            return std::holds_alternative<double>(*this);
+        }
+
+        bool IsBool() const {
+            return std::holds_alternative<bool>(*this);
+        }
+
+        bool IsArray() const {
+            return std::holds_alternative<Array>(*this);
+        }
+
         bool hasString() const {
-            return std::holds_alternative<std::string>(*this); //   
+            return std::holds_alternative<std::pmr::string>(*this); //   
         }
 
         const auto& AsArray() const {
-            return std::get<std::vector<Node>>(*this);
+            return std::get<Array>(*this);
         }
 
         const auto& AsMap() const {
-            return std::get<std::map<std::string, Node>>(*this);
+            return std::get<Dict>(*this);
         }
 
         int AsInt() const {
@@ -45,25 +112,170 @@ namespace Json {
             return std::get<int>(*this); //   
         }
 
-        const auto& AsString() const {
-            return std::get<std::string>(*this);
+        std::string_view AsString() const {
+            return std::get<std::pmr::string>(*this);
         }
 
         std::ostream& PushToStream(std::ostream& os) const;
     };
 
+    inline Dict::Items::const_iterator Dict::lowerBound(std::string_view key) const {
+        return std::lower_bound(items.begin(), items.end(), key, 
+            [](const Item& item, std::string_view key) { return std::string_view(item.first) < key; });
+    }
+
+    inline Dict::Items::const_iterator Dict::find(std::string_view key) const {
+        auto it = lowerBound(key);
+        if (it != items.end() && it->first == key)
+            return it;
+        return items.end();
+    }
+
+    inline size_t Dict::count(std::string_view key) const {
+        return find(key) != items.end();
+    }
+
+    inline const Node& Dict::at(std::string_view key) const {
+        auto it = find(key);
+        if (it == items.end())
+            throw std::out_of_range("Json::Dict::at: no key " + std::string(key));
+        return it->second;
+    }
+
+    class Handler { //   (SAX) 
+    public:
+        virtual ~Handler() = default;
+
+        virtual void StartObject() = 0;
+        virtual void Key(std::string_view key) = 0;
+        virtual void EndObject() = 0;
+        virtual void StartArray() = 0;
+        virtual void EndArray() = 0;
+
+        virtual void String(std::string_view value) = 0;
+        virtual void Int(int value) = 0;
+        virtual void Double(double value) = 0;
+        virtual void Bool(bool value) = 0;
+        virtual void Null() = 0;
+    };
+
+    class NodeBuilder : public Handler { // Node  ,    
+    public:
+        explicit NodeBuilder(std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+        void StartObject() override;
+        void Key(std::string_view key) override;
+        void EndObject() override;
+        void StartArray() override;
+        void EndArray() override;
+
+        void String(std::string_view value) override;
+        void Int(int value) override;
+        void Double(double value) override;
+        void Bool(bool value) override;
+        void Null() override;
+
+        bool IsComplete() const;
+        Node TakeRoot();
+
+    private:
+        struct Frame {
+            bool isObject;
+            size_t firstValue; //            
+            size_t firstKey;
+        };
+
+        void AddValue(Node node);
+
+        std::pmr::memory_resource* resource;
+        std::vector<Node> values;
+        std::vector<std::pmr::string> keys;
+        std::vector<size_t> order;
+        std::vector<Frame> stack;
+        std::vector<Node> root;
+    };
+
+    class Rope { //  :   (,  )  ,  
+    public:
+        struct Segment {
+            std::string_view text;
+            bool escaped; //   JSON
+        };
+
+        explicit Rope(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : segments(resource) {}
+
+        Rope& Append(std::string_view text) {
+            segments.push_back({ text, false });
+            return *this;
+        }
+
+        Rope& AppendEscaped(std::string_view text) {
+            segments.push_back({ text, true });
+            return *this;
+        }
+
+        const std::pmr::vector<Segment>& Segments() const { return segments; }
+
+    private:
+        std::pmr::vector<Segment> segments;
+    };
+
+    std::string EscapeString(std::string_view value); // ,   Rope
+
+    class Writer { // JSON   ,    Node::PushToStream
+    public:
+        explicit Writer(int precision = 10);
+        explicit Writer(std::ostream& output, int precision = 10); //Flush    
+
+        Writer& StartObject();
+        Writer& Key(std::string_view key);
+        Writer& EndObject();
+        Writer& StartArray();
+        Writer& EndArray();
+
+        Writer& String(std::string_view value);
+        Writer& String(const Rope& value); //      
+        Writer& Int(int value);
+        Writer& Double(double value);
+        Writer& Number(double value); //    int
+        Writer& Bool(bool value);
+        Writer& Null();
+        Writer& Value(const Node& node);
+
+        const std::string& GetBuffer() const;
+        void Clear();
+        void Flush();
+
+    private:
+        void BeforeValue();
+        void AppendEscaped(std::string_view value);
+
+        std::ostream* output = nullptr;
+        int precision;
+        std::string buffer;
+        std::vector<bool> firstElement;
+        bool afterKey = false;
+    };
+
     class Document {
     public:
         explicit Document(Node root);
+        Document(std::unique_ptr<std::pmr::monotonic_buffer_resource> arena, Node root); //    
 
         const Node& GetRoot() const;
 
     private:
-        Node root;
+        std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
+        std::unique_ptr<Node> ownedRoot;
+        Node* root;
     };
 
+    Document Load(std::string_view buffer);
     Document Load(std::istream& input);
 
+    void Parse(std::string_view buffer, Handler& handler);
+    void Parse(std::istream& input, Handler& handler);
+
 }
 
 std::ostream& operator<<(std::ostream& os, const Json::Node& node);
@@ -0,0 +1,168 @@
+#include "jsonindex.h"
+#include "json.h"
+
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace Json {
+
+    namespace {
+
+        constexpr size_t BLOCK_SIZE = 64;
+
+        struct BlockMasks {
+            uint64_t quote;
+            uint64_t backslash;
+            uint64_t op;
+            uint64_t space;
+        };
+
+
+#if defined(__AVX2__)
+
+        uint64_t Mask32(__m256i lo, __m256i hi, char c) {
+            const __m256i pattern = _mm256_set1_epi8(c);
+            uint64_t low = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, pattern)));
+            uint64_t high = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, pattern)));
+            return low | (high << 32);
+        }
+
+        BlockMasks ClassifyBlock(const char* block) {
+            const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+            const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+            BlockMasks masks;
+            masks.quote = Mask32(lo, hi, '"');
+            masks.backslash = Mask32(lo, hi, '\\');
+            masks.op = Mask32(lo, hi, '{') | Mask32(lo, hi, '}') | Mask32(lo, hi, '[')
+                | Mask32(lo, hi, ']') | Mask32(lo, hi, ':') | Mask32(lo, hi, ',');
+            masks.space = Mask32(lo, hi, ' ') | Mask32(lo, hi, '\n') | Mask32(lo, hi, '\r') | Mask32(lo, hi, '\t');
+            return masks;
+        }
+
+#elif defined(__SSE2__)
+
+        uint64_t Mask16(const __m128i (&chunks)[4], char c) {
+            const __m128i pattern = _mm_set1_epi8(c);
+            uint64_t mask = 0;
+            for (int i = 0; i < 4; ++i)
+                mask |= static_cast<uint64_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[i], pattern))) << (16 * i);
+            return mask;
+        }
+
+        BlockMasks ClassifyBlock(const char* block) {
+            __m128i chunks[4];
+            for (int i = 0; i < 4; ++i)
+                chunks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+            BlockMasks masks;
+            masks.quote = Mask16(chunks, '"');
+            masks.backslash = Mask16(chunks, '\\');
+            masks.op = Mask16(chunks, '{') | Mask16(chunks, '}') | Mask16(chunks, '[')
+                | Mask16(chunks, ']') | Mask16(chunks, ':') | Mask16(chunks, ',');
+            masks.space = Mask16(chunks, ' ') | Mask16(chunks, '\n') | Mask16(chunks, '\r') | Mask16(chunks, '\t');
+            return masks;
+        }
+
+#else
+
+        BlockMasks ClassifyBlock(const char* block) {
+            BlockMasks masks{};
+            for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+                const uint64_t bit = 1ULL << i;
+                switch (block[i]) {
+                    case '"': masks.quote |= bit; break;
+                    case '\\': masks.backslash |= bit; break;
+                    case '{': case '}': case '[': case ']': case ':': case ',': masks.op |= bit; break;
+                    case ' ': case '\n': case '\r': case '\t': masks.space |= bit; break;
+                }
+            }
+            return masks;
+        }
+
+#endif
+
+
+        uint64_t PrefixXor(uint64_t bits) { //Бит i = чётность числа кавычек на позициях [0, i]
+            bits ^= bits << 1;
+            bits ^= bits << 2;
+            bits ^= bits << 4;
+            bits ^= bits << 8;
+            bits ^= bits << 16;
+            bits ^= bits << 32;
+            return bits;
+        }
+
+    }
+
+
+    size_t StructuralIndexer::Scan(string_view buffer, uint32_t offset, bool last, vector<uint32_t>& index) {
+        size_t scanned = 0;
+        for (; scanned + BLOCK_SIZE <= buffer.size(); scanned += BLOCK_SIZE)
+            ScanBlock(buffer.data() + scanned, offset + static_cast<uint32_t>(scanned), index);
+
+        if (last && scanned < buffer.size()) { //Хвост дополняем пробелами до полного блока
+            char tail[BLOCK_SIZE];
+            memset(tail, ' ', BLOCK_SIZE);
+            memcpy(tail, buffer.data() + scanned, buffer.size() - scanned);
+            ScanBlock(tail, offset + static_cast<uint32_t>(scanned), index);
+            scanned = buffer.size();
+        }
+        return scanned;
+    }
+
+
+    void StructuralIndexer::ScanBlock(const char* block, uint32_t offset, vector<uint32_t>& index) {
+        const BlockMasks masks = ClassifyBlock(block);
+
+        const uint64_t escaped = FindEscaped(masks.backslash);
+        const uint64_t quotes = masks.quote & ~escaped;
+        const uint64_t inString = PrefixXor(quotes) ^ stringCarry;
+        stringCarry = 0ULL - (inString >> 63);
+
+        const uint64_t structural = masks.op & ~inString;
+        const uint64_t openQuotes = quotes & inString;
+        const uint64_t scalars = ~(masks.op | masks.space | quotes | inString);
+        const uint64_t scalarStarts = scalars & ~((scalars << 1) | scalarCarry);
+        scalarCarry = scalars >> 63;
+
+        uint64_t tokens = structural | openQuotes | scalarStarts;
+        while (tokens) {
+            index.push_back(offset + static_cast<uint32_t>(__builtin_ctzll(tokens)));
+            tokens &= tokens - 1;
+        }
+    }
+
+
+    uint64_t StructuralIndexer::FindEscaped(uint64_t backslashes) { //Экранированные символы; обратные слэши редки, идём по битам
+        uint64_t escaped = escapeCarry;
+        uint64_t escapers = backslashes & ~escaped;
+        escapeCarry = 0;
+        while (escapers) {
+            const int i = __builtin_ctzll(escapers);
+            escapers &= escapers - 1;
+            if (i == 63) {
+                escapeCarry = 1;
+                break;
+            }
+            escaped |= 1ULL << (i + 1);
+            escapers &= ~(1ULL << (i + 1));
+        }
+        return escaped;
+    }
+
+
+    vector<uint32_t> BuildStructuralIndex(string_view buffer) {
+        if (buffer.size() >= UINT32_MAX)
+            throw ParsingError("Document is too large for the structural index");
+
+        vector<uint32_t> index;
+        index.reserve(buffer.size() / 8);
+        StructuralIndexer().Scan(buffer, 0, true, index);
+        return index;
+    }
+
+}
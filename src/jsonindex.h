@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace Json {
+
+    //Первая стадия разбора: позиции всех токенов документа (структурные символы вне строк,
+    //открывающие кавычки и начала чисел/литералов), найденные блоками по 64 байта
+    std::vector<uint32_t> BuildStructuralIndex(std::string_view buffer);
+
+
+    class StructuralIndexer { //Тот же индекс по частям: состояние строк и скаляров переносится между вызовами
+    public:
+        //Дописывает в index позиции токенов buffer со сдвигом offset и возвращает число обработанных байт.
+        //Хвост короче блока остаётся на следующий вызов, если это не последняя часть
+        size_t Scan(std::string_view buffer, uint32_t offset, bool last, std::vector<uint32_t>& index);
+
+    private:
+        void ScanBlock(const char* block, uint32_t offset, std::vector<uint32_t>& index);
+        uint64_t FindEscaped(uint64_t backslashes);
+
+        uint64_t stringCarry = 0;
+        uint64_t scalarCarry = 0;
+        uint64_t escapeCarry = 0;
+    };
+
+}
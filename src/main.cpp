@@ -3,6 +3,8 @@
 #include "parser.h"
 #include "routefinder.h"
 #include "maprender.h"
+#include "requestarena.h"
+#include "catalogholder.h"
 
 
 #include <iostream>
@@ -10,6 +12,7 @@
 #include <fstream>
 #include <iomanip>
 #include <memory>
+#include <array>
 
 
 #include "transport_catalog.pb.h"
@@ -24,21 +27,17 @@ class RequestsManager { //TODO вынести в отдельны хэдер
 public:
     RequestsManager() {} 
 
-    string ReadFileData(const string& file_name) {
-        ifstream file(file_name, ios::binary | ios::ate);
-        const ifstream::pos_type end_pos = file.tellg();
-        file.seekg(0, ios::beg);
+    void MakeBase(istream& input) { //base_requests читаются потоком по частям, без построения дерева Node и без копии всего ввода
 
-        string data(end_pos, '\0');
-        file.read(&data[0], end_pos);
-        return data;
+        cerr << "RAM before MakeBase "<< getRAM() << endl;
+        BaseRequestsHandler handler(parser);
+        Json::Parse(input, handler);
+        parser.build();
+        serializeBase(handler.getSettings());
     }
 
-    void MakeBase(const Json::Document& document) { 
 
-        cerr << "RAM before MakeBase "<< getRAM() << endl;
-        const auto& mainNode = document.GetRoot().AsMap();
-        parser.parseMakeRequests(mainNode);
+    void serializeBase(const Json::Dict& mainNode) {
         Database::TransportCatalog db;
         parser.serialize(db);
         parser.serializeYellowPages(db, mainNode.at("yellow_pages")); 
@@ -49,8 +48,8 @@ public:
         mapRender = make_unique<MapRender>(parser, mainNode.at("render_settings"));
         mapRender->serialize(db);
 
-        ofstream os(getSerializeFilename(mainNode));
-        os << db.SerializeAsString();
+        ofstream os(getSerializeFilename(mainNode), ios::binary);
+        CatalogHolder::Write(db, os);
         cerr << "RAM after MakeBase "<< getRAM() << endl;
     }
 
@@ -59,25 +58,69 @@ public:
 
         const auto& mainNode = document.GetRoot().AsMap();
         parser.parseProcessRequests(mainNode);
+        loadBase(getSerializeFilename(mainNode));
 
-        Database::TransportCatalog db;
-        db.ParseFromString(ReadFileData(getSerializeFilename(mainNode))); //db.ParseFromIstream(&is);
-        
-        parser.deserialize(db);
-        routeFinder.deserialize(parser, db);
+        for (const auto& r : parser.getStatRequests()) //Читаются только секции, нужные запросам пакета
+            loadSectionsFor(r);
+    }
 
-        mapRender = make_unique<MapRender>(db, parser);
-        prepareInvertedIndecies();
+
+    void loadBase(const string& filename) { //Остальные секции - по первому запросу, которому они нужны
+        catalog = make_unique<CatalogHolder>(filename);
+        catalog->load(CatalogSection::Stats);
+        parser.deserialize(catalog->get());
     }
 
 
-    void run(ostream& os) const { 
-        os << setprecision(10);
-        vector<Json::Node> jsonArray;
-        processTransportRequests(jsonArray);
-        processYellowPagesRequests(jsonArray);
-        processRouteToCompanyRequests(jsonArray);
-        os << jsonArray;
+    void run(ostream& os) const { //Ответы в порядке stat_requests, каждый уходит в поток сразу после вычисления
+        Json::Writer writer(os);
+        writer.StartArray();
+        for (const auto& request : parser.getStatRequests()) {
+            processRequest(request, writer);
+            finishRecord(writer);
+        }
+        writer.EndArray();
+        writer.Flush();
+    }
+
+
+    //Запросы выполняются по мере разбора stat_requests, ответы идут в порядке поступления.
+    //Если stat_requests стоят раньше serialization_settings, они копятся до загрузки базы
+    void runPipelined(istream& input, ostream& os) {
+        Json::Writer writer(os);
+        vector<AnyRequest> pending;
+        bool baseLoaded = false;
+
+        writer.StartArray();
+        StatRequestsHandler handler(
+            [&](AnyRequest request) {
+                if (baseLoaded == false) {
+                    pending.push_back(move(request));
+                    return;
+                }
+                loadSectionsFor(request);
+                processRequest(request, writer);
+                finishRecord(writer);
+                os.flush(); //Ответ уходит читателю, не дожидаясь конца ввода
+            },
+            [&](const string& key, const Json::Node& node) {
+                if (key != "serialization_settings")
+                    return;
+                loadBase(string(node.AsMap().at("file").AsString()));
+                baseLoaded = true;
+                for (const auto& request : pending) {
+                    loadSectionsFor(request);
+                    processRequest(request, writer);
+                    finishRecord(writer);
+                }
+                pending.clear();
+                os.flush();
+            });
+        Json::Parse(input, handler);
+        if (baseLoaded == false) //Как и в пакетном режиме: без базы на запросы не ответить
+            throw runtime_error("No serialization_settings in process_requests input");
+        writer.EndArray();
+        writer.Flush();
     }
 
 
@@ -85,13 +128,18 @@ public:
 
  private:
 
+    unique_ptr<CatalogHolder> catalog; //Объявлен первым: всё ниже ссылается на загруженную базу
     Parser parser;
     RouteFinder routeFinder;
     unique_ptr <MapRender> mapRender;
 
+    mutable RequestArena arena; //Сбрасывается после каждого ответа
+
     using CompanyPtr = const YellowPages::Company*;
-    using SearchResults = unordered_set<CompanyPtr>;
-    using InvIdxMap = unordered_map<string, SearchResults>;
+    using IndexSet = unordered_set<CompanyPtr>;
+    using InvIdxMap = unordered_map<string, IndexSet>;
+    using SearchResults = pmr::unordered_set<CompanyPtr>; //Промежуточные множества живут в arena
+    using CompaniesList = pmr::vector<const string*>;
 
     InvIdxMap invIdxNames; 
     InvIdxMap invIdxRubrics;
@@ -99,6 +147,53 @@ public:
     InvIdxMap invIdxPhones;
 
 
+    void loadSectionsFor(const Request& r) { //Bus и Stop обходятся секцией Stats
+        if (r.type == RequestType::Route)
+            loadRouter();
+        if (r.type == RequestType::Route || r.type == RequestType::Map)
+            loadRender();
+    }
+
+
+    void loadSectionsFor(const FindCompanyRequest&) {
+        loadYellowPages();
+    }
+
+
+    void loadSectionsFor(const RouteToCompanyRequest&) {
+        loadRouter();
+        loadRender();
+    }
+
+
+    void loadSectionsFor(const AnyRequest& request) {
+        visit([this](const auto& r) { loadSectionsFor(r); }, request);
+    }
+
+
+    void loadYellowPages() {
+        if (catalog->load(CatalogSection::YellowPages) == false)
+            return;
+        parser.deserializeYellowPages(catalog->get());
+        prepareInvertedIndecies();
+    }
+
+
+    void loadRouter() {
+        loadYellowPages(); //Рёбра до компаний ссылаются на их имена
+        catalog->loadSeparately(CatalogSection::Router, [this](auto& section) { //RouteFinder копирует граф и таблицу себе
+            routeFinder.deserialize(parser, section);
+        });
+    }
+
+
+    void loadRender() {
+        loadYellowPages(); //Координаты компаний привязаны к полным именам
+        if (catalog->load(CatalogSection::Render))
+            mapRender = make_unique<MapRender>(catalog->get(), parser);
+    }
+
+
     void addInvertedIndex(const string& value, CompanyPtr ptr, InvIdxMap& indecies) {
         if (indecies.count(value)) 
             indecies[value].insert(ptr);
@@ -140,7 +235,7 @@ public:
         if (phones.empty() || found.empty())
             return;
 
-        SearchResults toDelete;
+        SearchResults toDelete(arena.get());
         for (const auto& comp: found) {
                bool companyIsFine = false;
                 for (size_t i = 0; i < comp->phones_size(); ++i) {
@@ -164,7 +259,7 @@ public:
 
 
     auto searchPhoneInIdxNoClean(const vector<Phone>& phones) const {
-        SearchResults foundResults;
+        SearchResults foundResults(arena.get());
         for (const auto& phoneRecord: phones) {
             if (invIdxPhones.count(phoneRecord.number)) {
                 const auto& found = invIdxPhones.at(phoneRecord.number);    
@@ -176,7 +271,7 @@ public:
 
 
     auto searchInIdx(const vector<string>& values, const InvIdxMap& indecies) const {
-        SearchResults foundResults;
+        SearchResults foundResults(arena.get());
         for (const auto& val: values) 
             if (indecies.count(val)) {
                 const auto& found = indecies.at(val);
@@ -186,25 +281,22 @@ public:
     }
 
 
-    void processYellowPagesRequests(vector<Json::Node>& jsonArray) const  {
-        const auto& requests = parser.getCompanyRequests();
-        map<string, Json::Node> outputRecord;
-        vector<Json::Node> companiesList;
-        
-        for (const auto& r : requests) {
-            outputRecord["request_id"] = r.requestId;
-            processSingleYellowRequest(r, companiesList);
-            outputRecord["companies"] = move(companiesList);
-            jsonArray.push_back(move(outputRecord));
-        }
+    void processYellowPagesRequest(const FindCompanyRequest& r, Json::Writer& writer) const  {
+        CompaniesList companiesList(arena.get());
+        processSingleYellowRequest(r, companiesList);
+        writer.StartObject().Key("companies").StartArray();
+        for (const auto name : companiesList)
+            writer.String(*name);
+        writer.EndArray();
+        writer.Key("request_id").Int(r.requestId).EndObject();
     }
 
 
-    void processSingleYellowRequest(const FindCompanyRequest& r, vector<Json::Node>& companiesList) const {
+    void processSingleYellowRequest(const FindCompanyRequest& r, CompaniesList& companiesList) const {
 
-        vector<bool> searchFlags;
-        vector<SearchResults*> foundCategories; 
-        SearchResults buffers[2]; 
+        array<bool, 3> searchFlags;
+        array<SearchResults*, 3> foundCategories; 
+        SearchResults buffers[2] = { SearchResults(arena.get()), SearchResults(arena.get()) }; 
 
         auto namesResults = searchInIdx(r.names, invIdxNames); 
         auto rubricResults = searchInIdx(r.rubrics, invIdxRubrics);
@@ -227,142 +319,129 @@ public:
             for (const auto ptr: *searchResults)
                 for (const auto& name: ptr->names()) 
                     if (name.type() == 0) {
-                        companiesList.push_back(name.value());
+                        companiesList.push_back(&name.value());
                         break;
                     }  
     }
 
 
-    void processRouteToCompanyRequests(vector<Json::Node>& jsonArray) const  {
-        const auto& requests = parser.getRouteToCompanyRequest();
-        map<string, Json::Node> outputRecord; 
+    void processRouteToCompanyRequest(const RouteToCompanyRequest& r, Json::Writer& writer) const {
+        CompaniesList companiesList(arena.get());
+        processSingleYellowRequest(r, companiesList);
+        const auto& from = r.from;
+        if (companiesList.empty()) {
+            writeNotFound(writer, r.requestId);
+            return;
+        }
 
-        for (const auto& r: requests) {
-            vector<Json::Node> companiesList;
-            processSingleYellowRequest(r, companiesList);
-            outputRecord["request_id"] = r.requestId;
-            const auto& from = r.from;
-            if (companiesList.empty()) {
-                outputRecord["error_message"] = "not found"s;
-                jsonArray.push_back(move(outputRecord));
+        RouteAction bestRoute {true, numeric_limits<double>::max()};
+        double waitTime = 0;
+        const auto& schedules = parser.getSchedules();
+        const auto& companyIdx = parser.getCompanyIdx();
+        
+        for (const auto company: companiesList) { //Если не нашлось - маршрут не найден
+            RouteAction route = routeFinder.findRoute(from, *company, parser);
+            if (route.notFound)
                 continue;
-            }
-
-            RouteAction bestRoute {true, numeric_limits<double>::max()};
-            double waitTime = 0;
-            const auto& workInt = parser.getWorkIntervals();
-            
-            for (const auto& company: companiesList) { //Если не нашлось - маршрут не найден
-                RouteAction route = routeFinder.findRoute(from, company.AsString(), parser);
-                if (route.notFound)
-                    continue;
-                const auto& companyIntervals = workInt.at(company.AsString());
+            const auto& schedule = schedules[companyIdx.at(*company)];
 
-                double now = r.currentTime + route.totalTime;
+            double now = r.currentTime + route.totalTime;
 
-                if (route.notFound == false && 
-                    (bestRoute.totalTime + waitTime) > route.totalTime) {
+            if (route.notFound == false && 
+                (bestRoute.totalTime + waitTime) > route.totalTime) {
 
-                    double waitInterval = findWaitInterval(companyIntervals, now);
-                    double totalTime = waitInterval + route.totalTime;
+                double waitInterval = schedule.waitTime(now);
+                double totalTime = waitInterval + route.totalTime;
 
-                    if ((bestRoute.totalTime + waitTime) > totalTime) {
-                        bestRoute = route;
-                        waitTime = waitInterval;
-                    }
+                if ((bestRoute.totalTime + waitTime) > totalTime) {
+                    bestRoute = route;
+                    waitTime = waitInterval;
                 }
             }
+        }
 
-            if (bestRoute.notFound) {
-                outputRecord["error_message"] = "not found"s;
-            }
-            else {
-                outputRecord["total_time"] = bestRoute.totalTime + waitTime; 
-                vector<Json::Node> actions;
-                fillRouteActions(actions, bestRoute);
-
-                if (waitTime != 0) {
-                    map<string, Json::Node> action;
-                    action["type"] = "WaitCompany"s;
-                    action["time"] = waitTime;
-                    action["company"] = bestRoute.finalStop;
-                    actions.push_back(action);
-                }
-                
-                outputRecord["items"] = move(actions);
-
-                ostringstream oss; 
-                oss << setprecision(10);
-                mapRender->buildCompanyRoute(bestRoute, oss);
-                if (debug) {
-                    static int routeCount = 0;
-                    ++routeCount;
-                    ofstream routeOutput("../inOut/lastCRoute" + to_string(routeCount) + ".svg");
-                    routeOutput << oss.str();
-                }
-                outputRecord["map"] = oss.str();
-            }
-            jsonArray.push_back(move(outputRecord));
+        if (bestRoute.notFound) {
+            writeNotFound(writer, r.requestId);
+            return;
         }
-    }
 
-    double findWaitInterval(const vector<pair<uint32_t, uint32_t>>& intervals, double now) const {
-        for (const auto& interval: intervals) 
-            if (now >= interval.first && now < interval.second)  //Не просто больше
-                return 0;
-            else if (now < interval.first) {
-                return interval.first - now;
-            }
-        double tillTheEnd = 24 * 60 * 7 - now;
-        if (tillTheEnd < 0) {
-            now = -tillTheEnd;
-            tillTheEnd = 0;
+        writer.StartObject().Key("items").StartArray();
+        fillRouteActions(writer, bestRoute);
+        if (waitTime != 0) {
+            writer.StartObject()
+                .Key("company").String(bestRoute.finalStop)
+                .Key("time").Double(waitTime)
+                .Key("type").String("WaitCompany")
+                .EndObject();
         }
-        else
-            now = 0;
-        double foundTime = 0;
-        for (const auto& interval: intervals) 
-            if (now >= interval.first && now < interval.second) { //<= во второй части тоже
-                foundTime = 0;
+        writer.EndArray();
+
+        pmr::string overlay(arena.get());
+        mapRender->buildCompanyRouteOverlay(bestRoute, overlay);
+        if (debug) {
+            static int routeCount = 0;
+            ++routeCount;
+            ofstream routeOutput("../inOut/lastCRoute" + to_string(routeCount) + ".svg");
+            routeOutput << mapRender->getRenderedBase() << overlay;
+        }
+        writer.Key("map").String(routeMap(overlay));
+        writer.Key("request_id").Int(r.requestId);
+        writer.Key("total_time").Double(bestRoute.totalTime + waitTime);
+        writer.EndObject();
+    }
+
+
+    void fillRouteActions(Json::Writer& writer, const RouteAction& route) const { //Ключи в алфавитном порядке, как выводил map
+        for (const auto& a : route.actions) {
+            writer.StartObject();
+            switch (a.type) {
+            case ActionType::WaitBus:
+                writer.Key("stop_name").String(*a.name);
                 break;
-            }
-            else if (now < interval.first) {
-                foundTime = interval.first - now;
+            case ActionType::RideBus:
+                writer.Key("bus").String(*a.name);
+                writer.Key("span_count").Int(a.spans);
+                break;
+            case ActionType::WalkToCompany:
+                writer.Key("company").String(*a.companyName);
+                writer.Key("stop_name").String(*a.name);
                 break;
             }
-        return foundTime + tillTheEnd;
+            writer.Key("time").Number(a.time);
+            writer.Key("type").String(actionTypeName(a.type));
+            writer.EndObject();
+        }
     }
 
 
-    void fillRouteActions(vector<Json::Node>& actions, const RouteAction& route) const {
-        for (const auto& a : route.actions) {
-            map<string, Json::Node> action;
-            action["type"] = a.type;
+    void finishRecord(Json::Writer& writer) const {
+        writer.Flush();
+        arena.reset();
+    }
 
-            if (isDoubleInteger(a.time)) {
-                int intTime = a.time;
-                action["time"] = intTime;
-            }
-            else
-                action["time"] = a.time;
-
-            if (a.type == "WaitBus")
-                action["stop_name"] = a.name;
-            if (a.type == "RideBus") {
-                action["bus"] = a.name;
-                action["span_count"] = int(a.spans); //Грязный хук :)
-            }
-            if (a.type == "WalkToCompany") {
-                action["stop_name"] = a.name;
-                action["company"] = a.companyName;
-            }
-            actions.push_back(move(action));
-        }
+
+    Json::Rope routeMap(string_view overlay) const { //Базовая карта не копируется, в ответ дописывается только слой маршрута
+        Json::Rope map(arena.get());
+        map.AppendEscaped(mapRender->getRenderedBaseJson()).Append(overlay);
+        return map;
+    }
+
+
+    void writeNotFound(Json::Writer& writer, int requestId) const {
+        writeError(writer, requestId, "not found");
+    }
+
+
+    void writeError(Json::Writer& writer, int requestId, string_view message) const {
+        writer.StartObject()
+            .Key("error_message").String(message)
+            .Key("request_id").Int(requestId)
+            .EndObject();
     }
 
 
     SearchResults intersection(const SearchResults& set1, const SearchResults& set2) const {
-        SearchResults newSet;    
+        SearchResults newSet(arena.get());    
         if (set1.size() > set2.size()) {
             for (const auto element: set2)
                 if (set1.count(element)) 
@@ -377,8 +456,8 @@ public:
     }
 
 
-    SearchResults* mergeSearchResults(const vector<bool>& searchFlags, 
-        const vector<SearchResults*>& foundCategories, SearchResults* buffers) const
+    SearchResults* mergeSearchResults(const array<bool, 3>& searchFlags, 
+        const array<SearchResults*, 3>& foundCategories, SearchResults* buffers) const
     {           
         SearchResults* first = nullptr, * second = nullptr;
         size_t intersectionCount = 0;
@@ -404,95 +483,112 @@ public:
     }
 
 
-    void processTransportRequests(vector<Json::Node>& jsonArray) const {
-        const auto& requests = parser.getRequests();
-        for (const auto& r : requests) {
-            map<string, Json::Node> outputRecord;
-            outputRecord["request_id"] = r.requestId;
-            if (r.type == RequestType::Map)
-                processMapRequest(outputRecord);
-            if (r.type == RequestType::Bus)
-                processBusRequest(r.name, outputRecord);
-            if (r.type == RequestType::Stop)
-                processStopRequest(r.name, outputRecord);
-            if (r.type == RequestType::Route)
-                processRouteRequest(r.name, r.name2, outputRecord);
-            jsonArray.push_back(move(outputRecord));
-        }
+    void processRequest(const AnyRequest& request, Json::Writer& writer) const {
+        if (auto r = get_if<Request>(&request))
+            processTransportRequest(*r, writer);
+        else if (auto r = get_if<FindCompanyRequest>(&request))
+            processYellowPagesRequest(*r, writer);
+        else
+            processRouteToCompanyRequest(get<RouteToCompanyRequest>(request), writer);
     }
 
 
-    void processMapRequest(map<string, Json::Node>& outputRecord) const {
-        ostringstream oss;
-        oss << setprecision(10); 
-        mapRender->getMap().Render(oss);
+    void processTransportRequest(const Request& r, Json::Writer& writer) const {
+        if (r.type == RequestType::Map)
+            processMapRequest(r.requestId, r.view, writer);
+        if (r.type == RequestType::Bus)
+            processBusRequest(r.requestId, r.name, writer);
+        if (r.type == RequestType::Stop)
+            processStopRequest(r.requestId, r.name, writer);
+        if (r.type == RequestType::Route)
+            processRouteRequest(r.requestId, r.name, r.name2, writer);
+    }
+
+
+    void processMapRequest(int requestId, const MapView& view, Json::Writer& writer) const {
+        if (const auto bad = std::get_if<BadMapView>(&view)) {
+            writeError(writer, requestId, bad->message);
+            return;
+        }
+        if (!std::holds_alternative<std::monostate>(view)) {
+            const auto svg = mapRender->renderView(view);
+            Json::Rope map(arena.get());
+            map.Append(*svg);
+            writer.StartObject()
+                .Key("map").String(map)
+                .Key("request_id").Int(requestId)
+                .EndObject();
+            return;
+        }
         if (debug) {
             ofstream mapOutput("../inOut/lastMap.svg");
-            mapOutput << oss.str();
+            mapOutput << mapRender->getRenderedMap();
         }
-        outputRecord["map"] = oss.str();
+        Json::Rope map(arena.get());
+        map.AppendEscaped(mapRender->getRenderedMapJson());
+        writer.StartObject()
+            .Key("map").String(map)
+            .Key("request_id").Int(requestId)
+            .EndObject();
     }
 
 
-    void processBusRequest(const string& busName, map<string, Json::Node>& outputRecord) const {
+    void processBusRequest(int requestId, const string& busName, Json::Writer& writer) const {
         const auto& busStats = parser.getBusStats();
 
-        if (busStats.count(busName)) {
-            outputRecord["stop_count"] = busStats.at(busName).totalStops;
-            outputRecord["unique_stop_count"] = busStats.at(busName).uniqueStops;
-
-            double routeLendth = busStats.at(busName).routeLengthNew;
-            if (isDoubleInteger(routeLendth)) {
-                int intLen = routeLendth;
-                outputRecord["route_length"] = intLen;
-            }
-            else
-                outputRecord["route_length"] = routeLendth;
-
-            outputRecord["curvature"] = busStats.at(busName).routeCoef;
+        if (busStats.count(busName) == 0) {
+            writeNotFound(writer, requestId);
+            return;
         }
-        else
-            outputRecord["error_message"] = "not found"s;
+        const auto& stats = busStats.at(busName);
+        writer.StartObject()
+            .Key("curvature").Double(stats.routeCoef)
+            .Key("request_id").Int(requestId)
+            .Key("route_length").Number(stats.routeLengthNew)
+            .Key("stop_count").Int(stats.totalStops)
+            .Key("unique_stop_count").Int(stats.uniqueStops)
+            .EndObject();
     }
 
 
-    void processStopRequest(const string& stopName, map<string, Json::Node>& outputRecord) const {
+    void processStopRequest(int requestId, const string& stopName, Json::Writer& writer) const {
         const auto& stopStats = parser.getStopStats();
 
-        if (stopStats.count(stopName)) {
-            vector<Json::Node> buses;
-            if (stopStats.at(stopName).buses.empty() == false)
-                for (const auto& busName : stopStats.at(stopName).buses)
-                    buses.push_back(busName);
-            outputRecord["buses"] = move(buses);
+        if (stopStats.count(stopName) == 0) {
+            writeNotFound(writer, requestId);
+            return;
         }
-        else
-            outputRecord["error_message"] = "not found"s;
+        writer.StartObject().Key("buses").StartArray();
+        for (const auto& busName : stopStats.at(stopName).buses)
+            writer.String(busName);
+        writer.EndArray();
+        writer.Key("request_id").Int(requestId).EndObject();
     }
 
 
-    void processRouteRequest(const string& from, const string& to, map<string, Json::Node>& outputRecord) const {
+    void processRouteRequest(int requestId, const string& from, const string& to, Json::Writer& writer) const {
         
         RouteAction route = routeFinder.findRoute(from, to, parser);
         if (route.notFound) {
-            outputRecord["error_message"] = "not found"s;
+            writeNotFound(writer, requestId);
+            return;
         }
-        else {
-            outputRecord["total_time"] = route.totalTime;
-            vector<Json::Node> actions;
-            fillRouteActions(actions, route);
-            outputRecord["items"] = move(actions);
-            ostringstream oss;
-            oss << setprecision(10);
-            mapRender->buildRoute(route, oss);
-            if (debug) {
-                static int routeCount = 0;
-                ++routeCount;
-                ofstream routeOutput("../inOut/lastRoute" + to_string(routeCount) + ".svg");
-                routeOutput << oss.str();
-            }
-            outputRecord["map"] = oss.str();
+        writer.StartObject().Key("items").StartArray();
+        fillRouteActions(writer, route);
+        writer.EndArray();
+
+        pmr::string overlay(arena.get());
+        mapRender->buildRouteOverlay(route, overlay);
+        if (debug) {
+            static int routeCount = 0;
+            ++routeCount;
+            ofstream routeOutput("../inOut/lastRoute" + to_string(routeCount) + ".svg");
+            routeOutput << mapRender->getRenderedBase() << overlay;
         }
+        writer.Key("map").String(routeMap(overlay));
+        writer.Key("request_id").Int(requestId);
+        writer.Key("total_time").Double(route.totalTime);
+        writer.EndObject();
     }
 
 
@@ -507,15 +603,9 @@ public:
     }
 
 
-    string getSerializeFilename(const map<string, Json::Node>& document) const {
+    string getSerializeFilename(const Json::Dict& document) const {
         const auto& serializationSettings = document.at("serialization_settings").AsMap();
-        const auto& filename = serializationSettings.at("file").AsString();
-        return filename;
-    }
-
-
-    double isDoubleInteger(double value) const {
-        return value == round(value);
+        return string(serializationSettings.at("file").AsString());
     }
 };
 
@@ -523,8 +613,7 @@ public:
 void runMakeBase(int testNumber) {
     RequestsManager manager; 
     ifstream input("../inOut/in" + to_string(testNumber) + ".json"); 
-    auto json = Json::Load(input); 
-    manager.MakeBase(json); 
+    manager.MakeBase(input); 
 }
 
 
@@ -549,24 +638,28 @@ void runTest(int testNumber) {
 //TODO проверить приватность всех классов, а так же константность всех методов - финальный рефакторинг
 int main(int argc, const char* argv[]) {
 
-    if (argc != 2) {
+    if (argc == 1) {
         runTest(1);
         runTest(2);
         runMakeBase(3);
     }
 
-    if (argc != 2) {
-        cerr << "Usage: transport_catalog_part_o [make_base|process_requests]\n";
+    if ((argc != 2 && argc != 3) || (argc == 3 && string_view(argv[2]) != "--pipelined")) {
+        cerr << "Usage: transport_catalog_part_o [make_base|process_requests [--pipelined]]\n";
         return 5;
     }
 
     const string_view mode(argv[1]);
+    const bool pipelined = argc == 3;
     
+    ios::sync_with_stdio(false); //Иначе у cin нет буфера и ввод читается по байту
     //*
     RequestsManager manager;
     if (mode == "make_base") {
-        const auto& json = Json::Load(cin); 
-        manager.MakeBase(json); 
+        manager.MakeBase(cin); 
+
+    } else if (mode == "process_requests" && pipelined) {
+        manager.runPipelined(cin, cout);
 
     } else if (mode == "process_requests") {
         const auto& json = Json::Load(cin); 
@@ -5,6 +5,9 @@
 #include "parser.h"
 
 #include "routefinder.h"
+#include "fragmentcache.h"
+#include "spatialindex.h"
+#include "threadpool.h"
 
 #include <vector>
 #include <string>
@@ -14,6 +17,9 @@
 #include <numeric>
 #include <unordered_set>
 #include <stdexcept>
+#include <memory_resource>
+#include <mutex>
+#include <cmath>
 
 #include "transport_catalog.pb.h"
 
@@ -61,7 +67,7 @@ void colorDeserialize(Svg::Color& color, const Database::SvgColor& colorDeser) {
 
 Svg::Color readColor(const Json::Node& colorNode) {
         if (colorNode.hasString())
-            return Svg::Color{ colorNode.AsString() };
+            return Svg::Color{ std::string(colorNode.AsString()) };
         else {
             const auto& colorArr = colorNode.AsArray();
             if (colorArr.size() == 3)
@@ -100,6 +106,13 @@ struct RendringSettings {
     double companyRadius;
     double companyLineWidth;
 
+    static constexpr int MaxSvgPrecision = 10;
+    int svgPrecision = -1; //Знаков после точки. Не задана: как раньше, 10 значащих цифр, а в основе карты маршрутов - 6
+    bool compactSvg = false; //Повторяющиеся стили выводятся css-классами
+
+    Svg::NumberFormat mapFormat() const { return svgPrecision >= 0 ? Svg::NumberFormat{svgPrecision, true} : Svg::NumberFormat{10, false}; }
+    Svg::NumberFormat routeBaseFormat() const { return svgPrecision >= 0 ? Svg::NumberFormat{svgPrecision, true} : Svg::NumberFormat{6, false}; }
+
     void serialize(Database::RenderingSettings* settings) {
         settings->set_max_width(maxWidth); //TODO fun proto + settings as arguments
         settings->set_max_height(maxHeight);
@@ -112,6 +125,9 @@ struct RendringSettings {
         settings->set_outer_margin(outerMargin);
         settings->set_company_radius(companyRadius);
         settings->set_company_line_width(companyLineWidth);
+        if (svgPrecision >= 0)
+            settings->set_svg_precision(svgPrecision);
+        settings->set_compact_svg(compactSvg);
 
         auto stopLabelSer = settings->mutable_stop_label_offset();
         stopLabelSer->set_x(stopLabelOffset.x);
@@ -141,6 +157,8 @@ struct RendringSettings {
         outerMargin = settings.outer_margin();
         companyRadius = settings.company_radius();
         companyLineWidth = settings.company_line_width();
+        svgPrecision = settings.has_svg_precision() ? static_cast<int>(settings.svg_precision()) : -1;
+        compactSvg = settings.compact_svg();
 
         const auto& stopLabelOffsetDeser = settings.stop_label_offset();
         stopLabelOffset = {stopLabelOffsetDeser.x(), stopLabelOffsetDeser.y()};
@@ -154,7 +172,7 @@ struct RendringSettings {
     }
 
 
-    void set(const std::map<std::string, Json::Node>& settings) {
+    void set(const Json::Dict& settings) {
         maxWidth = settings.at("width").AsDouble();
         maxHeight = settings.at("height").AsDouble();
         padding = settings.at("padding").AsDouble();
@@ -177,18 +195,34 @@ struct RendringSettings {
         
         const auto& layersArr = settings.at("layers").AsArray();
         for (const auto& layer : layersArr)
-            layers.push_back(layer.AsString());
+            layers.emplace_back(layer.AsString());
         
         outerMargin = settings.at("outer_margin").AsDouble();
 
         companyRadius = settings.at("company_radius").AsDouble();
         companyLineWidth = settings.at("company_line_width").AsDouble();
+
+        if (settings.count("svg_precision")) {
+            svgPrecision = settings.at("svg_precision").AsInt();
+            if (svgPrecision < 0 || svgPrecision > MaxSvgPrecision)
+                throw std::invalid_argument("svg_precision must be from 0 to " + std::to_string(MaxSvgPrecision));
+        }
+        if (settings.count("compact_svg"))
+            compactSvg = settings.at("compact_svg").AsBool();
     }
 };
 
 
 
 
+struct MapTileHasher {
+    size_t operator()(const MapTile& tile) const {
+        return (static_cast<size_t>(tile.lod) << 63) ^ (static_cast<size_t>(tile.z) << 48)
+            ^ (static_cast<size_t>(tile.x) << 24) ^ tile.y;
+    }
+};
+
+
 class MapRender {
 
 public:
@@ -196,13 +230,26 @@ public:
     MapRender(const Parser& parser, const Json::Node& settingsNode) : parser(parser) {
         const auto& settings = settingsNode.AsMap();
         renderSettings.set(settings);
+        compileLayers();
     } 
 
     MapRender(Database::TransportCatalog& db, const Parser& parser) 
         : parser(parser) 
     {
         deserialize(db);
-        buildMap();
+        compileLayers();
+        buildStopPositions();
+        if (db.rendered_map().empty()) //База без готовой карты - строим как раньше
+            buildMap();
+        else { //Без копий: строки лежат в базе, которая живёт дольше рендера
+            renderedMap = db.rendered_map();
+            cache = db.rendered_route_base();
+            styles.Reset(renderSettings.mapFormat());
+            for (const auto& style : db.svg_styles()) //Классы, на которые ссылается готовая карта
+                styles.AddStyle(style);
+        }
+        renderedMapJson = Json::EscapeString(renderedMap);
+        cacheJson = Json::EscapeString(cache);
     } 
 
 
@@ -238,6 +285,12 @@ public:
 
         auto settings = db.mutable_render_settings();
         renderSettings.serialize(settings);
+
+        buildMap(); //Готовая карта сохраняется в базу, process_requests не строит Svg::Document
+        db.set_rendered_map(ownedMap);
+        db.set_rendered_route_base(ownedCache);
+        for (const auto& style : styles.GetStyles())
+            db.add_svg_styles(style);
     }
 
 
@@ -270,58 +323,365 @@ public:
     }
 
 
-    void buildRoute(const RouteAction& route, std::ostream& os) const {
+    //Маршрут отдаётся кусками: общая базовая карта (getRenderedBase) и собственный слой маршрута
+    void buildRouteOverlay(const RouteAction& route, std::pmr::string& svg) const {
+        renderRouteOverlay(route, svg, routeLayers);
+    }
 
-        if (cache.empty()) 
-            mapDoc.RenderNoEnd(os);
-        else
-            os << cache;
 
-        Svg::Document routeDoc;
-        addRouteTransparentRect(routeDoc);
-        if (route.actions.size() != 0)
-            for (const auto& layer : renderSettings.layers)
-                if (routeRenderFunctions.at(layer))
-                    (this->*routeRenderFunctions.at(layer))(routeDoc, route);
-        routeDoc.RenderNoStart(os);
+    void buildCompanyRouteOverlay(const RouteAction& route, std::pmr::string& svg) const {
+        renderRouteOverlay(route, svg, companyRouteLayers);
     }
 
 
-    void buildCompanyRoute(const RouteAction& route, std::ostream& os) const {
-
-        if (cache.empty()) 
-            mapDoc.RenderNoEnd(os);
-        else
-            os << cache;
-            
-        Svg::Document routeDoc;
-        addRouteTransparentRect(routeDoc);
-        if (route.actions.size() != 0)
-            for (const auto& layer : renderSettings.layers)
-                (this->*routeCompanyRenderFunctions.at(layer))(routeDoc, route);
-        routeDoc.RenderNoStart(os);
+    //Часть карты: в ответ идут только объекты, задевающие область, линии обрезаются по сегментам.
+    //Плитки кэшируются по (z, x, y), произвольные прямоугольники рисуются каждый раз
+    std::shared_ptr<const std::string> renderView(const MapView& view) const {
+        if (const auto tile = std::get_if<MapTile>(&view))
+            return tiles.get(*tile, [&] {
+                return renderBox(tile->lod ? getLodIndex(tile->z) : getTileIndex(), tileBox(*tile));
+            });
+        const auto& b = std::get<MapBox>(view);
+        return std::make_shared<const std::string>(renderBox(getTileIndex(), { b.minX, b.minY, b.maxX, b.maxY }));
     }
 
+
+    std::string_view getRenderedBase() const { return cache; }
+    std::string_view getRenderedBaseJson() const { return cacheJson; }
+    std::string_view getRenderedMap() const { return renderedMap; }
+    std::string_view getRenderedMapJson() const { return renderedMapJson; }
+
 private:
 
-    std::string cache;
+    std::string_view cache; //Начало карты для маршрутов, без </svg>; в ownedCache или в базе
+    std::string cacheJson; //cache, заранее экранированный для ответа
+    std::string_view renderedMap; //Карта целиком для запросов Map
+    std::string renderedMapJson;
+    std::string ownedCache; //Карта, построенная здесь, а не взятая из базы
+    std::string ownedMap;
 
     void buildMap() {
+        const bool parallel = stopCoordinates.size() >= ParallelLayersThreshold;
+        const auto layers = buildMapLayers(parallel);
+        styles.Reset(renderSettings.mapFormat());
+        if (renderSettings.compactSvg)
+            for (const auto& layer : layers)
+                styles.Add(layer);
+        auto renderLayer = [&](size_t i, Svg::Output& os) { layers[i].RenderObjects(os); };
+
+        std::pmr::string buffer;
+        auto mapOutput = makeOutput(buffer, renderSettings.mapFormat());
+        Svg::Document::RenderStart(mapOutput);
+        renderLayers(mapOutput, layers.size(), parallel, renderLayer);
+        Svg::Document::RenderEnd(mapOutput);
+        ownedMap.assign(buffer.data(), buffer.size());
+        renderedMap = ownedMap;
+
+        buffer.clear();
+        auto baseOutput = makeOutput(buffer, renderSettings.routeBaseFormat());
+        Svg::Document::RenderStart(baseOutput);
+        renderLayers(baseOutput, layers.size(), parallel, renderLayer);
+        ownedCache.assign(buffer.data(), buffer.size());
+        cache = ownedCache;
+    }
+
+
+    //Стили берутся из таблицы, собранной по карте: у объектов только маршрутов их может не быть, тогда пишутся атрибуты
+    Svg::Output makeOutput(std::pmr::string& buffer, Svg::NumberFormat format) const {
+        return Svg::Output(buffer, format, renderSettings.compactSvg ? &styles : nullptr);
+    }
+
+
+    std::vector<Svg::Document> buildMapLayers(bool parallel) const { //Документ на каждый слой карты из mapLayers
+        std::vector<Svg::Document> layers(mapLayers.size());
+        forEachLayer(mapLayers.size(), parallel, [&](size_t i) { (this->*mapLayers[i])(layers[i]); });
+        return layers;
+    }
+
+
+    //Слои независимы до склейки и разбираются общим пулом потоков вместе с текущим.
+    //Без parallel задачи выполняются по очереди в этом же потоке
+    template <typename Job>
+    static void forEachLayer(size_t count, bool parallel, const Job& job) {
+        if (parallel) {
+            ThreadPool::shared().parallelFor(count, job);
+            return;
+        }
+        for (size_t i = 0; i < count; ++i)
+            job(i);
+    }
+
+
+    //Каждый слой пишется в свой буфер, буферы дописываются в os по порядку слоёв.
+    //Последовательно слои пишутся прямо в os, без промежуточных буферов
+    template <typename RenderLayer>
+    static void renderLayers(Svg::Output& os, size_t count, bool parallel, const RenderLayer& renderLayer) {
+        if (parallel == false || count < 2) {
+            for (size_t i = 0; i < count; ++i)
+                renderLayer(i, os);
+            return;
+        }
+        std::vector<std::pmr::string> parts(count); //Не в арене запроса: monotonic_buffer_resource не для нескольких потоков
+        forEachLayer(count, true, [&](size_t i) {
+            Svg::Output part(parts[i], os.GetFormat(), os.GetStyles());
+            renderLayer(i, part);
+        });
+        for (const auto& part : parts)
+            os << std::string_view(part);
+    }
+
+
+    struct TileIndex {
+        Svg::Document map; //Те же слои, что и в buildMap
+        std::vector<size_t> layerEnds; //Объекты слоя i - до layerEnds[i] в map
+        std::vector<Box> bounds; //Рамка каждого объекта карты
+        SpatialGrid<uint64_t> grid; //Номер объекта << 32 | номер сегмента линии (у остальных UINT32_MAX)
+    };
+
+    static constexpr uint32_t WholeObject = UINT32_MAX;
+
+
+    const TileIndex& getTileIndex() const { //Строится при первом запросе части карты
+        std::call_once(tileIndexFlag, [this] {
+            Svg::Document doc;
+            std::vector<size_t> layerEnds;
+            for (auto& layer : buildMapLayers(stopCoordinates.size() >= ParallelLayersThreshold)) {
+                doc.Append(std::move(layer));
+                layerEnds.push_back(doc.GetObjects().size());
+            }
+            tileIndex = buildTileIndex(std::move(doc), std::move(layerEnds));
+        });
+        return *tileIndex;
+    }
+
+
+    //Пиксель плитки масштаба z в единицах холста: плитка рисуется на TilePixels точек по ширине
+    double lodPixel(uint32_t z) const {
+        return renderSettings.maxWidth / (1u << z) / TilePixels;
+    }
+
+
+    //Для каждого масштаба своя упрощённая карта: линии по Дугласу-Пекеру с допуском в пиксель,
+    //остановки и надписи, которые мельче порога, выброшены
+    const TileIndex& getLodIndex(uint32_t z) const {
+        std::lock_guard<std::mutex> lock(lodMutex);
+        auto& index = lodIndexes[z];
+        if (index)
+            return *index;
+
+        const double pixel = lodPixel(z);
+        const auto& full = getTileIndex();
+        const auto& objects = full.map.GetObjects();
         Svg::Document doc;
-        for (const auto& layer : renderSettings.layers)
-            if (renderFunctions.at(layer))
-                (this->*renderFunctions.at(layer))(doc);
-        mapDoc = std::move(doc);
-        if (cache.empty()) {
-            std::ostringstream oss;
-            try {
-                mapDoc.RenderNoEnd(oss);
+        std::vector<size_t> layerEnds;
+        size_t layerBegin = 0;
+        for (const size_t layerEnd : full.layerEnds) {
+            for (size_t i = layerBegin; i < layerEnd; ++i) {
+                const auto& object = objects[i];
+                if (const auto circle = std::get_if<Svg::Circle>(&object)) {
+                    if (circle->GetRadius() * 2 < MinCirclePixels * pixel)
+                        continue;
+                }
+                else if (const auto text = std::get_if<Svg::Text>(&object)) {
+                    if (text->GetFontSize() < MinLabelPixels * pixel)
+                        continue;
+                }
+                else if (const auto line = std::get_if<Svg::Polyline>(&object)) {
+                    Svg::Polyline simplified(*line);
+                    simplified.SetPoints(simplifyLine(line->GetPoints(), pixel));
+                    doc.Add(std::move(simplified));
+                    continue;
+                }
+                doc.Add(object);
+            }
+            layerEnds.push_back(doc.GetObjects().size());
+            layerBegin = layerEnd;
+        }
+        index = buildTileIndex(std::move(doc), std::move(layerEnds));
+        return *index;
+    }
+
+
+    static std::vector<Svg::Point> simplifyLine(const std::vector<Svg::Point>& points, double tolerance) {
+        if (points.size() < 3)
+            return points;
+
+        std::vector<bool> keep(points.size());
+        keep.front() = keep.back() = true;
+        std::vector<std::pair<size_t, size_t>> ranges{ {0, points.size() - 1} };
+        while (!ranges.empty()) {
+            const auto [first, last] = ranges.back();
+            ranges.pop_back();
+            double maxDistance = 0;
+            size_t farthest = first;
+            for (size_t i = first + 1; i < last; ++i) {
+                const double distance = segmentDistance(points[i], points[first], points[last]);
+                if (distance > maxDistance) {
+                    maxDistance = distance;
+                    farthest = i;
+                }
+            }
+            if (maxDistance > tolerance) {
+                keep[farthest] = true;
+                ranges.push_back({ first, farthest });
+                ranges.push_back({ farthest, last });
+            }
+        }
+
+        std::vector<Svg::Point> result;
+        for (size_t i = 0; i < points.size(); ++i)
+            if (keep[i])
+                result.push_back(points[i]);
+        return result;
+    }
+
+
+    static double segmentDistance(Svg::Point p, Svg::Point a, Svg::Point b) {
+        const double dx = b.x - a.x, dy = b.y - a.y;
+        const double lengthSq = dx * dx + dy * dy;
+        double t = lengthSq > 0 ? ((p.x - a.x) * dx + (p.y - a.y) * dy) / lengthSq : 0;
+        t = std::clamp(t, 0.0, 1.0);
+        return std::hypot(p.x - a.x - t * dx, p.y - a.y - t * dy);
+    }
+
+
+    std::unique_ptr<const TileIndex> buildTileIndex(Svg::Document doc, std::vector<size_t> layerEnds) const {
+        const auto& objects = doc.GetObjects();
+        std::vector<Box> bounds;
+        bounds.reserve(objects.size());
+        size_t itemCount = 0;
+        for (const auto& object : objects) {
+            bounds.push_back(std::visit([](const auto& value) { return objectBox(value); }, object));
+            const auto line = std::get_if<Svg::Polyline>(&object);
+            itemCount += line && line->GetPoints().size() > 1 ? line->GetPoints().size() - 1 : 1;
+        }
+
+        const size_t cellsPerSide = std::clamp<size_t>(std::sqrt(itemCount / 8.0), 1, 512);
+        auto index = std::make_unique<TileIndex>(TileIndex{ std::move(doc), std::move(layerEnds), std::move(bounds),
+            SpatialGrid<uint64_t>({ 0, 0, renderSettings.maxWidth, renderSettings.maxHeight }, cellsPerSide) });
+
+        const auto& indexed = index->map.GetObjects();
+        for (uint64_t i = 0; i < indexed.size(); ++i) {
+            const auto line = std::get_if<Svg::Polyline>(&indexed[i]);
+            if (line && line->GetPoints().size() > 1) {
+                const auto& points = line->GetPoints();
+                for (uint64_t j = 0; j + 1 < points.size(); ++j)
+                    index->grid.insert(segmentBox(*line, j), i << 32 | j);
             }
-            catch (std::runtime_error& re) {
-                return;
+            else
+                index->grid.insert(index->bounds[i], i << 32 | WholeObject);
+        }
+        return index;
+    }
+
+
+    Box tileBox(const MapTile& tile) const {
+        const double width = renderSettings.maxWidth / (1u << tile.z);
+        const double height = renderSettings.maxHeight / (1u << tile.z);
+        return { tile.x * width, tile.y * height, (tile.x + 1) * width, (tile.y + 1) * height };
+    }
+
+
+    std::string renderBox(const TileIndex& index, const Box& box) const {
+        const auto& objects = index.map.GetObjects();
+        std::vector<uint64_t> found;
+        index.grid.query(box, found);
+
+        //Кандидаты отсортированы, поэтому порядок объектов как у полной карты, а кандидаты слоя идут подряд
+        std::vector<size_t> foundEnds;
+        for (const size_t layerEnd : index.layerEnds)
+            foundEnds.push_back(std::lower_bound(found.begin(), found.end(), static_cast<uint64_t>(layerEnd) << 32) - found.begin());
+
+        std::pmr::string buffer;
+        auto os = makeOutput(buffer, renderSettings.mapFormat());
+        Svg::Document::RenderStart(os, { box.minX, box.minY }, box.maxX - box.minX, box.maxY - box.minY);
+        renderLayers(os, foundEnds.size(), found.size() >= ParallelTileThreshold, [&](size_t layer, Svg::Output& part) {
+            Svg::Document doc;
+            for (size_t i = layer ? foundEnds[layer - 1] : 0; i < foundEnds[layer]; ) {
+                const size_t object = found[i] >> 32;
+                size_t end = i;
+                while (end < found.size() && (found[end] >> 32) == object)
+                    ++end;
+                if ((found[i] & WholeObject) != WholeObject)
+                    addVisibleRuns(doc, std::get<Svg::Polyline>(objects[object]), found.begin() + i, found.begin() + end, box);
+                else if (index.bounds[object].intersects(box))
+                    doc.Add(objects[object]);
+                i = end;
+            }
+            doc.RenderObjects(part);
+        });
+        Svg::Document::RenderEnd(os);
+        return std::string(buffer);
+    }
+
+
+    //Подряд идущие видимые сегменты линии становятся отдельными ломаными с тем же стилем
+    void addVisibleRuns(Svg::Document& doc, const Svg::Polyline& line,
+        std::vector<uint64_t>::const_iterator first, std::vector<uint64_t>::const_iterator last, const Box& box) const {
+        const auto& points = line.GetPoints();
+        auto flush = [&](size_t runFirst, size_t runLast) {
+            Svg::Polyline part(line);
+            part.SetPoints({ points.begin() + runFirst, points.begin() + runLast + 2 });
+            doc.Add(std::move(part));
+        };
+
+        bool inRun = false;
+        size_t runFirst = 0, runLast = 0;
+        for (auto it = first; it != last; ++it) {
+            const size_t segment = *it & WholeObject;
+            if (!segmentBox(line, segment).intersects(box))
+                continue;
+            if (inRun && segment == runLast + 1)
+                runLast = segment;
+            else {
+                if (inRun)
+                    flush(runFirst, runLast);
+                inRun = true;
+                runFirst = runLast = segment;
             }
-            cache = oss.str();
         }
+        if (inRun)
+            flush(runFirst, runLast);
+    }
+
+
+    static Box segmentBox(const Svg::Polyline& line, size_t segment) {
+        const auto& a = line.GetPoints()[segment];
+        const auto& b = line.GetPoints()[segment + 1];
+        const double pad = line.GetStrokeWidth() / 2;
+        return { std::min(a.x, b.x) - pad, std::min(a.y, b.y) - pad, std::max(a.x, b.x) + pad, std::max(a.y, b.y) + pad };
+    }
+
+    static Box objectBox(const Svg::Circle& circle) {
+        const auto c = circle.GetCenter();
+        const double r = circle.GetRadius() + circle.GetStrokeWidth() / 2;
+        return { c.x - r, c.y - r, c.x + r, c.y + r };
+    }
+
+    static Box objectBox(const Svg::Polyline& line) {
+        const auto& points = line.GetPoints();
+        Box box{ INFINITY, INFINITY, -INFINITY, -INFINITY };
+        const double pad = line.GetStrokeWidth() / 2;
+        for (const auto& p : points)
+            box = { std::min(box.minX, p.x - pad), std::min(box.minY, p.y - pad),
+                std::max(box.maxX, p.x + pad), std::max(box.maxY, p.y + pad) };
+        return box;
+    }
+
+    static Box objectBox(const Svg::Text& text) { //Ширину шрифта не знаем: берём с запасом, по кеглю на байт
+        const double x = text.GetPoint().x + text.GetOffset().x;
+        const double y = text.GetPoint().y + text.GetOffset().y;
+        const double size = text.GetFontSize();
+        const double pad = text.GetStrokeWidth();
+        return { x - pad, y - size - pad, x + size * text.GetData().size() + pad, y + size / 2 + pad };
+    }
+
+    static Box objectBox(const Svg::Rectangle&) { //Подложка маршрута - на карте не встречается, считаем видимой всегда
+        return { -INFINITY, -INFINITY, INFINITY, INFINITY };
+    }
+
+    static Box objectBox(const Svg::Fragment&) {
+        return { -INFINITY, -INFINITY, INFINITY, INFINITY };
     }
 
 
@@ -395,66 +755,100 @@ private:
         }
     }
 
-    std::set<std::string> findNeighbours(const std::string& stopName) const { 
+    struct Adjacency { //Соседи в виде CSR: соседи id лежат в neighbours[offsets[id] .. offsets[id + 1])
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> neighbours;
+    };
+
+
+    Adjacency buildAdjacency(const std::vector<std::string_view>& names) const {
+        std::unordered_map<std::string_view, uint32_t> ids;
+        ids.reserve(names.size());
+        for (uint32_t id = 0; id < names.size(); ++id)
+            ids.emplace(names[id], id);
+
         const auto& stopStats = parser.getStopStats();
         const auto& companyNeighbors = parser.getCompanyNeighbors();
-        if (stopStats.count(stopName)) 
-            return stopStats.at(stopName).neighbors;
-        else 
-            return companyNeighbors.at(stopName);
+        Adjacency adjacency;
+        adjacency.offsets.reserve(names.size() + 1);
+        adjacency.offsets.push_back(0);
+        for (const auto name : names) {
+            const std::string key(name);
+            const auto stopIt = stopStats.find(key);
+            const auto& neighbours = stopIt != stopStats.end() ? stopIt->second.neighbors : companyNeighbors.at(key);
+            for (const auto& n : neighbours)
+                if (const auto it = ids.find(n); it != ids.end())
+                    adjacency.neighbours.push_back(it->second);
+            adjacency.offsets.push_back(adjacency.neighbours.size());
+        }
+        return adjacency;
     }
 
 
-    size_t assignIdx(const std::vector<std::pair<double, std::string>>& coords, std::unordered_map<std::string, size_t>& assignedIdx) {
-        size_t maxFoundIdx = 0;
-        assignedIdx[coords[0].second] = 0;
-
-        for (size_t i = 1; i < coords.size(); ++i) {
-            const auto& stopName = coords[i].second;
-            const auto& neighbours = findNeighbours(stopName);
-
-            int maxIdx = -1;
-            for (const auto& n : neighbours)
-                if (assignedIdx.count(n))
-                    if (maxIdx < static_cast<int>(assignedIdx[n]))
-                        maxIdx = static_cast<int>(assignedIdx[n]);
-            assignedIdx[stopName] = maxIdx + 1;
-            if (maxFoundIdx < static_cast<size_t>(maxIdx + 1))
-                maxFoundIdx = static_cast<size_t>(maxIdx + 1);
+    //Номер по оси: на единицу больше, чем у уже пронумерованных соседей (тех, кто раньше в order).
+    //Возвращает номера по id и наибольший номер
+    static std::pair<std::vector<uint32_t>, uint32_t> compressAxis(const std::vector<uint32_t>& order, const Adjacency& adjacency) {
+        std::vector<uint32_t> rank(order.size());
+        for (uint32_t i = 0; i < order.size(); ++i)
+            rank[order[i]] = i;
+
+        std::vector<uint32_t> idx(order.size());
+        uint32_t maxFoundIdx = 0;
+        for (uint32_t i = 1; i < order.size(); ++i) {
+            const uint32_t id = order[i];
+            int64_t maxIdx = -1;
+            for (uint32_t k = adjacency.offsets[id]; k < adjacency.offsets[id + 1]; ++k) {
+                const uint32_t n = adjacency.neighbours[k];
+                if (rank[n] < i)
+                    maxIdx = std::max<int64_t>(maxIdx, idx[n]);
+            }
+            idx[id] = static_cast<uint32_t>(maxIdx + 1);
+            maxFoundIdx = std::max(maxFoundIdx, idx[id]);
         }
-        return maxFoundIdx;
+        return { std::move(idx), maxFoundIdx };
     }
 
 
     void glueAndCompressCoordinates() {
-        std::vector<std::pair<double, std::string>> xCoords, yCoords;
-        xCoords.reserve(stopCoordinates.size());
-        yCoords.reserve(stopCoordinates.size());
-        for (const auto& [stopName, stopCoords] : stopCoordinates) {
-            xCoords.push_back(make_pair(stopCoords.x, stopName ));
-            yCoords.push_back(make_pair(stopCoords.y, stopName ));
+        std::vector<std::string_view> names; //id - номер в stopCoordinates
+        std::vector<Svg::Point*> points;
+        names.reserve(stopCoordinates.size());
+        points.reserve(stopCoordinates.size());
+        for (auto& [stopName, stopCoords] : stopCoordinates) {
+            names.push_back(stopName);
+            points.push_back(&stopCoords);
         }
-        if (xCoords.size() > 1) {
-            sort(xCoords.begin(), xCoords.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
-            sort(yCoords.begin(), yCoords.end(), [](const auto& lhs, const auto& rhs) { return lhs.first > rhs.first; });
-
-            std::unordered_map<std::string, size_t> xIdx, yIdx;
-            size_t XbiggestIdx = assignIdx(xCoords, xIdx);
-            size_t YbiggestIdx = assignIdx(yCoords, yIdx);
+        if (names.size() > 1) {
+            const auto adjacency = buildAdjacency(names);
+
+            //Сортировка та же, что по парам (координата, имя) в порядке map, поэтому и равные координаты встают так же
+            auto axis = [&](auto less) {
+                std::vector<uint32_t> order(names.size());
+                std::iota(order.begin(), order.end(), 0);
+                std::sort(order.begin(), order.end(), less);
+                return compressAxis(order, adjacency);
+            };
+            std::pair<std::vector<uint32_t>, uint32_t> axes[2]; //x и y считаются параллельно
+            forEachLayer(2, names.size() >= ParallelAxesThreshold, [&](size_t i) {
+                if (i == 0)
+                    axes[0] = axis([&](uint32_t lhs, uint32_t rhs) { return points[lhs]->x < points[rhs]->x; });
+                else
+                    axes[1] = axis([&](uint32_t lhs, uint32_t rhs) { return points[lhs]->y > points[rhs]->y; });
+            });
+            const auto& [xIdx, XbiggestIdx] = axes[0];
+            const auto& [yIdx, YbiggestIdx] = axes[1];
 
             double xStep = (renderSettings.maxWidth - 2 * renderSettings.padding) / XbiggestIdx; 
             double yStep = (renderSettings.maxHeight - 2 * renderSettings.padding) / YbiggestIdx; 
 
-            for (size_t i = 0; i < xCoords.size(); ++i) {
-                const auto& stopNameX = xCoords[i].second; 
-                stopCoordinates[stopNameX].x = renderSettings.padding + xIdx[stopNameX] * xStep;
-                const auto& stopNameY = yCoords[i].second; 
-                stopCoordinates[stopNameY].y = renderSettings.maxHeight - renderSettings.padding - yIdx[stopNameY] * yStep;
+            for (size_t id = 0; id < points.size(); ++id) {
+                points[id]->x = renderSettings.padding + xIdx[id] * xStep;
+                points[id]->y = renderSettings.maxHeight - renderSettings.padding - yIdx[id] * yStep;
             }
         }
-        else if (xCoords.size() == 1) {
-            stopCoordinates[xCoords[0].second].x = renderSettings.padding;
-            stopCoordinates[xCoords[0].second].y = renderSettings.maxHeight - renderSettings.padding;
+        else if (names.size() == 1) {
+            points[0]->x = renderSettings.padding;
+            points[0]->y = renderSettings.maxHeight - renderSettings.padding;
         }
     }
 
@@ -523,12 +917,23 @@ private:
     }
 
 
-    void addStopPoint(Svg::Document& doc, const std::string& stopName) const {
+    Svg::Circle makeStopPoint(const std::string& stopName) const {
         const auto& stopPoint = stopCoordinates.at(stopName);
-        doc.Add(Svg::Circle{}
+        return Svg::Circle{}
             .SetCenter(stopPoint)
             .SetRadius(renderSettings.stopRadius)
-            .SetFillColor("white"));
+            .SetFillColor("white");
+    }
+
+
+    void addStopPoint(Svg::Document& doc, const std::string& stopName) const {
+        doc.Add(makeStopPoint(stopName));
+    }
+
+
+    void addCachedStopPoint(Svg::Document& doc, const std::string& stopName) const {
+        const FragmentKey key{ &stopCoordinates.at(stopName), UINT32_MAX, UINT32_MAX };
+        doc.Add(Svg::Fragment(fragments.get(key, [&] { return renderFragment(makeStopPoint(stopName)); })));
     }
 
 
@@ -570,9 +975,20 @@ private:
 
     using StopIt = std::vector<std::string>::const_iterator;
 
+    struct RideSegment { //Поездка на одном автобусе: считается один раз и используется всеми слоями
+        size_t action; //Индекс WaitBus в route.actions
+        const BusRoute* bus;
+        StopIt first;
+        StopIt last;
+    };
 
-    void addBusLine(Svg::Document& doc, const std::string& busName,
-        StopIt firstIt, StopIt lastIt) const { 
+    struct RoutePlan {
+        const RouteAction& route;
+        std::pmr::vector<RideSegment> rides;
+    };
+
+
+    Svg::Polyline makeBusLine(const std::string& busName, StopIt firstIt, StopIt lastIt) const { 
 
         Svg::Polyline line;
         line.SetStrokeColor(busColors.at(busName))
@@ -592,172 +1008,199 @@ private:
                 if (it == lastIt)
                     break;
             }
+        return line;
+    }
 
-        doc.Add(line);
+
+    void addBusLine(Svg::Document& doc, const std::string& busName, StopIt firstIt, StopIt lastIt) const { 
+        doc.Add(makeBusLine(busName, firstIt, lastIt));
     }
 
 
+    void addCachedBusLine(Svg::Document& doc, const std::string& busName, const BusRoute& busRoute, StopIt firstIt, StopIt lastIt) const { 
+        const auto& stops = busRoute.stops;
+        const FragmentKey key{ &stops, static_cast<uint32_t>(firstIt - stops.begin()), static_cast<uint32_t>(lastIt - stops.begin()) };
+        doc.Add(Svg::Fragment(fragments.get(key, [&] { return renderFragment(makeBusLine(busName, firstIt, lastIt)); })));
+    }
 
-    std::pair<StopIt,StopIt> findStopPair(const RouteAction& route, size_t i) const { //TODO возможно ошибка тут
-        const auto& allRoutes = parser.getRoutes();
 
-        const auto& stopName = route.actions.at(i).name;
-        const auto& busName = route.actions.at(i + 1).name;
-        const auto& busRoute = allRoutes.at(busName);
-        std::string nextStopName;
-        if (i < route.actions.size() - 2)
-            nextStopName = route.actions.at(i + 2).name;
-        else
-            nextStopName = route.finalStop;
+    template <typename Object>
+    std::string renderFragment(const Object& object) const {
+        std::pmr::string buffer;
+        auto os = makeOutput(buffer, renderSettings.mapFormat());
+        object.Render(os);
+        return std::string(buffer);
+    }
 
-        std::vector<StopIt> firstCandidates;
-        StopIt firstStop = find(busRoute.stops.begin(), busRoute.stops.end(), stopName);
-        while (firstStop != busRoute.stops.end()) {
-            firstCandidates.push_back(firstStop);
-            firstStop = find(firstStop + 1, busRoute.stops.end(), stopName);
-        }
-        
-        std::vector<StopIt> lastCandidates;
-        std::vector<std::string>::const_iterator lastStop;
+
+
+    std::pair<StopIt,StopIt> findStopPair(const RouteAction& route, size_t i, const BusRoute& busRoute) const { //Кандидаты берутся из индекса позиций, а не поиском по всему маршруту
+        const auto& stopName = *route.actions.at(i).name;
+        const auto& busName = *route.actions.at(i + 1).name;
+        const auto& nextStopName = i < route.actions.size() - 2 ? *route.actions.at(i + 2).name : route.finalStop;
+
+        const auto& positions = busStopPositions.at(busName);
+        const auto& firstCandidates = positions.at(stopName);
+        const auto& lastCandidates = positions.at(nextStopName);
+
+        const int64_t minLast = busRoute.isCyclic ? 1 : 0; //У кольцевого маршрута конец не ищется в первой остановке
+        const int64_t spanCount = route.actions.at(i + 1).spans;
+        auto isLast = [&](int64_t pos) {
+            return pos >= minLast && std::binary_search(lastCandidates.begin(), lastCandidates.end(), pos);
+        };
+        auto stopAt = [&](int64_t pos) { return busRoute.stops.begin() + pos; };
+
+        for (int64_t first : firstCandidates)
+            if (isLast(first + spanCount))
+                return { stopAt(first), stopAt(first + spanCount) };
         if (busRoute.isCyclic == false)
-            lastStop = find(busRoute.stops.begin(), busRoute.stops.end(), nextStopName);
-        else
-            lastStop = find(busRoute.stops.begin() + 1, busRoute.stops.end(), nextStopName);
-        while (lastStop != busRoute.stops.end()) {
-            lastCandidates.push_back(lastStop);
-            lastStop = find(lastStop + 1, busRoute.stops.end(), nextStopName);
-        }
-
-        int spanCount = route.actions.at(i + 1).spans;
-        size_t foundCandidate1 = 0, foundCandidate2 = 0;
-
-        bool found = false;
-        for (size_t i = 0; i < firstCandidates.size(); ++i) {
-            for (size_t j = 0; j < lastCandidates.size(); ++j) 
-                if (int diff = lastCandidates[j] - firstCandidates[i]; diff == spanCount) {
-                    foundCandidate1 = i;
-                    foundCandidate2 = j;
-                    found = true;
-                    break;
-                }
-            if (found)
-                break;
-        }
-        if (busRoute.isCyclic == false && found == false)
-            for (size_t i = 0; i < firstCandidates.size(); ++i) {
-                for (size_t j = 0; j < lastCandidates.size(); ++j) 
-                    if (int diff = lastCandidates[j] - firstCandidates[i]; diff == -spanCount) {
-                        foundCandidate1 = i;
-                        foundCandidate2 = j;
-                        found = true;
-                        break;
-                    }
-                if (found)
-                    break;
+            for (int64_t first : firstCandidates)
+                if (isLast(first - spanCount))
+                    return { stopAt(first), stopAt(first - spanCount) };
+
+        return { stopAt(firstCandidates.front()), stopAt(*std::lower_bound(lastCandidates.begin(), lastCandidates.end(), minLast)) };
+    }
+
+
+    using RouteLayer = void (MapRender::*)(Svg::Document& doc, const RoutePlan& plan) const;
+
+    void renderRouteOverlay(const RouteAction& route, std::pmr::string& svg, const std::vector<RouteLayer>& layers) const {
+        auto os = makeOutput(svg, renderSettings.mapFormat());
+        Svg::Document underlayer;
+        addRouteTransparentRect(underlayer);
+        underlayer.RenderObjects(os);
+        if (route.actions.size() != 0) {
+            const auto plan = planRoute(route, svg.get_allocator().resource());
+            renderLayers(os, layers.size(), planStopCount(plan) >= ParallelRouteThreshold, [&](size_t i, Svg::Output& part) {
+                Svg::Document doc;
+                (this->*layers[i])(doc, plan);
+                doc.RenderObjects(part);
+            });
         }
+        Svg::Document::RenderEnd(os);
+    }
 
-        firstStop = firstCandidates[foundCandidate1];
-        lastStop = lastCandidates[foundCandidate2];
-        return { firstStop, lastStop };
+
+    static size_t planStopCount(const RoutePlan& plan) {
+        size_t count = 0;
+        for (const auto& ride : plan.rides)
+            count += std::abs(ride.last - ride.first) + 1;
+        return count;
     }
 
 
-    void renderRouteBusLines(Svg::Document& doc, const RouteAction& route) const { 
-        for (size_t i = 0; i < route.actions.size() - 1; ++i) 
-            if (route.actions[i].type == "WaitBus") {
-                const auto& busName = route.actions[i + 1].name;
-                const auto& p = findStopPair(route, i);
-                addBusLine(doc, busName, p.first, p.second);
+    //Единственный проход по действиям маршрута: дальше слои видят только поездки с уже найденным автобусом и остановками
+    RoutePlan planRoute(const RouteAction& route, std::pmr::memory_resource* resource) const {
+        RoutePlan plan{ route, std::pmr::vector<RideSegment>(resource) };
+        const auto& routes = parser.getRoutes();
+        for (size_t i = 0; i + 1 < route.actions.size(); ++i) 
+            if (route.actions[i].type == ActionType::WaitBus) {
+                const auto& busRoute = routes.at(*route.actions[i + 1].name);
+                const auto& p = findStopPair(route, i, busRoute);
+                plan.rides.push_back({ i, &busRoute, p.first, p.second });
             }
+        return plan;
     }
 
 
-    void renderRouteStopCircles(Svg::Document& doc, const RouteAction& route) const {
-        for (size_t i = 0; i < route.actions.size() - 1; ++i) 
-            if (route.actions[i].type == "WaitBus") {
-                const auto& p = findStopPair(route, i);
+    void buildStopPositions() {
+        for (const auto& [busName, busRoute] : parser.getRoutes()) {
+            auto& positions = busStopPositions[busName];
+            for (size_t i = 0; i < busRoute.stops.size(); ++i)
+                positions[busRoute.stops[i]].push_back(i);
+        }
+    }
 
-                if (p.second > p.first) {
-                    for (auto it = p.first; it != (p.second + 1); ++it)
-                        addStopPoint(doc, *it);
-                }
-                else
-                    for (auto it = p.first;; --it) {
-                        addStopPoint(doc, *it);
-                        if (it == p.second)
-                            break;
-                    }
-            }
+
+    bool isEndPoint(const BusRoute& busRoute, const std::string& stopName) const {
+        const auto& endPoints = busRoute.endPoints; //Не больше двух элементов
+        return find(endPoints.begin(), endPoints.end(), stopName) != endPoints.end();
     }
 
 
+    void renderRouteBusLines(Svg::Document& doc, const RoutePlan& plan) const { 
+        for (const auto& ride : plan.rides) 
+            addCachedBusLine(doc, *plan.route.actions[ride.action + 1].name, *ride.bus, ride.first, ride.last);
+    }
 
-    void renderStopLabelsCommon(Svg::Document& doc, const RouteAction& route) const {
-        for (size_t i = 0; i < route.actions.size() - 1; ++i) 
-            if (route.actions[i].type == "WaitBus") {
-                const auto& stopName = route.actions[i].name;
-                addStopLabel(doc, stopName);
+
+    void renderRouteStopCircles(Svg::Document& doc, const RoutePlan& plan) const {
+        for (const auto& ride : plan.rides) {
+            if (ride.last > ride.first) {
+                for (auto it = ride.first; it != (ride.last + 1); ++it)
+                    addCachedStopPoint(doc, *it);
             }
+            else
+                for (auto it = ride.first;; --it) {
+                    addCachedStopPoint(doc, *it);
+                    if (it == ride.last)
+                        break;
+                }
+        }
     }
 
-    void renderRouteStopLabels(Svg::Document& doc, const RouteAction& route) const {
-        renderStopLabelsCommon(doc, route);
-        addStopLabel(doc, route.finalStop);
+
+
+    void renderStopLabelsCommon(Svg::Document& doc, const RoutePlan& plan) const {
+        for (const auto& ride : plan.rides) 
+            addStopLabel(doc, *plan.route.actions[ride.action].name);
     }
 
+    void renderRouteStopLabels(Svg::Document& doc, const RoutePlan& plan) const {
+        renderStopLabelsCommon(doc, plan);
+        addStopLabel(doc, plan.route.finalStop);
+    }
 
-    void renderCompanyRouteStopLabels(Svg::Document& doc, const RouteAction& route) const { 
-        renderStopLabelsCommon(doc, route);
-        const auto& finalStop = route.actions.back().name;
+
+    void renderCompanyRouteStopLabels(Svg::Document& doc, const RoutePlan& plan) const { 
+        renderStopLabelsCommon(doc, plan);
+        const auto& finalStop = *plan.route.actions.back().name;
         addStopLabel(doc, finalStop);
     }   
 
 
-    void renderEndpointsCommon(Svg::Document& doc, const RouteAction& route) const {
+    void renderEndpointsCommon(Svg::Document& doc, const RoutePlan& plan) const {
+        const auto& route = plan.route;
         const auto& allRoutes = parser.getRoutes();
-        for (size_t i = 0; i < route.actions.size() - 1; ++i) {
-            if (route.actions[i].type == "WaitBus") {
-                const auto& stopName = route.actions[i].name;
-                const auto& busName = route.actions[i + 1].name;
-                const auto& busRoute = allRoutes.at(busName);
-                if (i > 0) {
-                    const auto& prevBusName = route.actions[i - 1].name;
-                    const auto& prevRoute = allRoutes.at(prevBusName);
-                    if (find(prevRoute.endPoints.begin(), prevRoute.endPoints.end(), stopName) != prevRoute.endPoints.end())
-                        addBusLabel(doc, prevBusName, stopName);
-                }
-                if (find(busRoute.endPoints.begin(), busRoute.endPoints.end(), stopName) != busRoute.endPoints.end())
-                    addBusLabel(doc, busName, stopName);
+        for (const auto& ride : plan.rides) {
+            const size_t i = ride.action;
+            const auto& stopName = *route.actions[i].name;
+            const auto& busName = *route.actions[i + 1].name;
+            if (i > 0) {
+                const auto& prevBusName = *route.actions[i - 1].name;
+                if (isEndPoint(allRoutes.at(prevBusName), stopName))
+                    addBusLabel(doc, prevBusName, stopName);
             }
+            if (isEndPoint(*ride.bus, stopName))
+                addBusLabel(doc, busName, stopName);
         }
     }
 
-    void renderRouteEndpoints(Svg::Document& doc, const RouteAction& route) const {
-        renderEndpointsCommon(doc, route);
-        const auto& allRoutes = parser.getRoutes();
-        const auto& lastBusName = route.actions.back().name;
-        const auto& busRoute = allRoutes.at(lastBusName);
-        if (find(busRoute.endPoints.begin(), busRoute.endPoints.end(), route.finalStop) != busRoute.endPoints.end())
+    void renderRouteEndpoints(Svg::Document& doc, const RoutePlan& plan) const {
+        renderEndpointsCommon(doc, plan);
+        const auto& route = plan.route;
+        const auto& lastBusName = *route.actions.back().name;
+        if (isEndPoint(parser.getRoutes().at(lastBusName), route.finalStop))
             addBusLabel(doc, lastBusName, route.finalStop);
     }
 
-    void renderCompanyRouteEndpoints(Svg::Document& doc, const RouteAction& route) const { 
-        renderEndpointsCommon(doc, route);
-        const auto& allRoutes = parser.getRoutes();
+    void renderCompanyRouteEndpoints(Svg::Document& doc, const RoutePlan& plan) const { 
+        renderEndpointsCommon(doc, plan);
+        const auto& route = plan.route;
         if (route.actions.size() > 1) {
             size_t idx = route.actions.size() - 2;
-            const auto& lastBusName = route.actions[idx].name;
-            const auto& busRoute = allRoutes.at(lastBusName);
-            const auto& finalStop = route.actions.back().name;
-            if (find(busRoute.endPoints.begin(), busRoute.endPoints.end(), finalStop) != busRoute.endPoints.end())
+            const auto& lastBusName = *route.actions[idx].name;
+            const auto& finalStop = *route.actions.back().name;
+            if (isEndPoint(parser.getRoutes().at(lastBusName), finalStop))
                 addBusLabel(doc, lastBusName, finalStop);
         }
     }
 
 
-    void renderCompanyLines(Svg::Document& doc, const RouteAction& route) const { 
-        const auto& lastStop = route.actions.back().name;
-        const auto& company = route.actions.back().companyName;
+    void renderCompanyLines(Svg::Document& doc, const RoutePlan& plan) const { 
+        const auto& route = plan.route;
+        const auto& lastStop = *route.actions.back().name;
+        const auto& company = *route.actions.back().companyName;
         const auto& companyIdx = parser.getCompanyIdx();
         const auto& fullNames = parser.getCompanyFullNames();
         const auto& fullName = fullNames[companyIdx.at(company)];
@@ -773,10 +1216,11 @@ private:
         doc.Add(line);
     }
 
-    void renderCompanyPoints(Svg::Document& doc, const RouteAction& route) const { 
+    void renderCompanyPoints(Svg::Document& doc, const RoutePlan& plan) const { 
+        const auto& route = plan.route;
         const auto& companyIdx = parser.getCompanyIdx();
         const auto& fullNames = parser.getCompanyFullNames();
-        const auto& companyName = route.actions.back().companyName;
+        const auto& companyName = *route.actions.back().companyName;
         const auto& fullName = fullNames[companyIdx.at(companyName)];
         const auto& stopPoint = stopCoordinates.at(fullName);
         doc.Add(Svg::Circle{}
@@ -785,10 +1229,11 @@ private:
             .SetFillColor("black")); //Add point with param? on refact
     }
 
-    void renderCompanyLabels(Svg::Document& doc, const RouteAction& route) const { 
+    void renderCompanyLabels(Svg::Document& doc, const RoutePlan& plan) const { 
+        const auto& route = plan.route;
         const auto& companyIdx = parser.getCompanyIdx();
         const auto& fullNames = parser.getCompanyFullNames();
-        const auto& companyName = route.actions.back().companyName;
+        const auto& companyName = *route.actions.back().companyName;
         const auto& fullName = fullNames[companyIdx.at(companyName)];
         addStopLabel(doc, fullName);
     }
@@ -800,41 +1245,67 @@ private:
     RendringSettings renderSettings;
     std::map<std::string, Svg::Point> stopCoordinates;
     std::unordered_map<std::string, Svg::Color> busColors;
-    Svg::Document mapDoc;
-
-    std::unordered_map<std::string, void (MapRender::*)(Svg::Document& doc) const> renderFunctions = {
-        {"bus_lines", &MapRender::renderBusLines}, 
-        {"bus_labels", &MapRender::renderBusLabels},
-        {"stop_points", &MapRender::renderStopPoints},
-        {"stop_labels", &MapRender::renderStopLabels},
-        {"company_lines", nullptr},
-        {"company_points", nullptr},
-        {"company_labels", nullptr}
-    };
+    Svg::StyleSheet styles; //Заполняется только при compactSvg
 
+    static constexpr size_t ParallelAxesThreshold = 4096; //С меньшим числом остановок второй поток не окупается
+    static constexpr size_t ParallelLayersThreshold = 1024; //Остановок на карте, чтобы слои строились в своих потоках
+    static constexpr size_t ParallelTileThreshold = 8192; //Кандидатов из сетки на часть карты
+    static constexpr size_t ParallelRouteThreshold = 1024; //Остановок, проезжаемых маршрутом
 
-    std::unordered_map<std::string, void (MapRender::*)(Svg::Document& doc, const RouteAction& route) const> routeRenderFunctions = {
-        {"bus_lines", &MapRender::renderRouteBusLines},
-        {"bus_labels", &MapRender::renderRouteEndpoints},
-        {"stop_points", &MapRender::renderRouteStopCircles},
-        {"stop_labels", &MapRender::renderRouteStopLabels},
-        {"company_lines", nullptr},
-        {"company_points", nullptr}, 
-        {"company_labels", nullptr}
-    };
+    static constexpr size_t FragmentCacheBytes = 8 << 20;
+    mutable FragmentCache<> fragments{ FragmentCacheBytes }; //Линии и остановки маршрутов, уже в виде svg
+
+    static constexpr size_t TileCacheBytes = 32 << 20;
+    mutable FragmentCache<MapTile, MapTileHasher> tiles{ TileCacheBytes };
+    mutable std::once_flag tileIndexFlag;
+    mutable std::unique_ptr<const TileIndex> tileIndex;
+
+    static constexpr double TilePixels = 256;
+    static constexpr double MinCirclePixels = 2; //Остановка диаметром меньше - точка, не рисуем
+    static constexpr double MinLabelPixels = 6; //Надпись мельче не прочитать
+    mutable std::mutex lodMutex;
+    mutable std::unordered_map<uint32_t, std::unique_ptr<const TileIndex>> lodIndexes; //Масштаб -> упрощённая карта
+
+    using StopPositions = std::unordered_map<std::string_view, std::vector<uint32_t>>;
+    std::unordered_map<std::string_view, StopPositions> busStopPositions; //Автобус -> остановка -> её позиции в маршруте по возрастанию
+
+    using MapLayer = void (MapRender::*)(Svg::Document& doc) const;
 
-    std::unordered_map<std::string, void (MapRender::*)(Svg::Document& doc, const RouteAction& route) const> routeCompanyRenderFunctions = {
-        {"bus_lines", &MapRender::renderRouteBusLines},
-        {"bus_labels", &MapRender::renderCompanyRouteEndpoints},
-        {"stop_points", &MapRender::renderRouteStopCircles},
-        {"stop_labels", &MapRender::renderCompanyRouteStopLabels},
-        {"company_lines", &MapRender::renderCompanyLines},
-        {"company_points", &MapRender::renderCompanyPoints},
-        {"company_labels", &MapRender::renderCompanyLabels}
+    struct LayerStages { //Что рисует слой на карте, на маршруте и на маршруте до компании; nullptr - ничего
+        MapLayer map;
+        RouteLayer route;
+        RouteLayer companyRoute;
     };
 
+    //Слои из настроек разбираются один раз: дальше карта и маршруты идут по готовым спискам функций
+    std::vector<MapLayer> mapLayers;
+    std::vector<RouteLayer> routeLayers;
+    std::vector<RouteLayer> companyRouteLayers;
+
+
+    static const LayerStages& findLayerStages(const std::string& layer) {
+        static const std::unordered_map<std::string, LayerStages> stages = {
+            {"bus_lines", {&MapRender::renderBusLines, &MapRender::renderRouteBusLines, &MapRender::renderRouteBusLines}},
+            {"bus_labels", {&MapRender::renderBusLabels, &MapRender::renderRouteEndpoints, &MapRender::renderCompanyRouteEndpoints}},
+            {"stop_points", {&MapRender::renderStopPoints, &MapRender::renderRouteStopCircles, &MapRender::renderRouteStopCircles}},
+            {"stop_labels", {&MapRender::renderStopLabels, &MapRender::renderRouteStopLabels, &MapRender::renderCompanyRouteStopLabels}},
+            {"company_lines", {nullptr, nullptr, &MapRender::renderCompanyLines}},
+            {"company_points", {nullptr, nullptr, &MapRender::renderCompanyPoints}},
+            {"company_labels", {nullptr, nullptr, &MapRender::renderCompanyLabels}}
+        };
+        return stages.at(layer);
+    }
 
-public:
 
-    const Svg::Document& getMap() const { return mapDoc;  }
+    void compileLayers() {
+        for (const auto& layer : renderSettings.layers) {
+            const auto& stages = findLayerStages(layer);
+            if (stages.map)
+                mapLayers.push_back(stages.map);
+            if (stages.route)
+                routeLayers.push_back(stages.route);
+            if (stages.companyRoute)
+                companyRouteLayers.push_back(stages.companyRoute);
+        }
+    }
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "json.h"
+#include "schedule.h"
 #include <string>
 #include <unordered_map>
 #include <set>
@@ -12,7 +13,12 @@
 #include "database.pb.h"
 #include <google/protobuf/util/json_util.h>
 
+#include <memory>
 #include <sstream>
+#include <variant>
+#include <optional>
+#include <functional>
+#include <stdexcept>
 
 
 enum class RequestType {
@@ -23,11 +29,32 @@ enum class RequestType {
 };
 
 
+struct MapTile { //Холст делится на 2^z x 2^z плиток, x и y - номер плитки
+    uint32_t z, x, y;
+    bool lod = false; //Упрощённая под масштаб плитки геометрия
+
+    bool operator==(const MapTile& other) const {
+        return z == other.z && x == other.x && y == other.y && lod == other.lod;
+    }
+};
+
+struct MapBox { //Прямоугольник в координатах холста
+    double minX, minY, maxX, maxY;
+};
+
+struct BadMapView { //Неверная плитка или прямоугольник: отвечаем ошибкой только на этот запрос
+    std::string message;
+};
+
+using MapView = std::variant<std::monostate, MapTile, MapBox, BadMapView>; //monostate - карта целиком
+
+
 struct Request { //? union\variant
     RequestType type;
     int  requestId;
     std::string name;
     std::string name2; //На коленке адаптация для route
+    MapView view = {}; //Только для Map; у остальных запросов monostate
 };
 
 
@@ -53,6 +80,9 @@ struct RouteToCompanyRequest : FindCompanyRequest {
 };
 
 
+using AnyRequest = std::variant<Request, FindCompanyRequest, RouteToCompanyRequest>;
+
+
 struct Coordinates {
     double lat; //latitude
     double lon; //longitude
@@ -100,12 +130,12 @@ struct Company {
 class Parser {
 public:
 
-    void parseMakeRequests(const std::map<std::string, Json::Node>& document) {
+    void parseMakeRequests(const Json::Dict& document) {
         readInputRequestsJson(document.at("base_requests")); 
         build();
     }
 
-    void parseProcessRequests(const std::map<std::string, Json::Node>& document) {
+    void parseProcessRequests(const Json::Dict& document) {
         readOutputRequestsJson(document.at("stat_requests"));
     }
 
@@ -142,6 +172,8 @@ public:
                 companyNeighbors[fullName].insert(stopName);
                 stopStats[stopName].neighbors.insert(fullName);
             }
+
+            WeeklySchedule::build(company.working_time()).serialize(*db.add_company_schedules());
         }
     }
 
@@ -215,13 +247,17 @@ public:
             }
             routes[name] = std::move(route);
         }
-        yellowPages = db.yellow_pages();
-        for (const auto& p : yellowPages.rubrics()) 
+    }
+
+
+    void deserializeYellowPages(const Database::TransportCatalog& db) { //Отдельная секция базы, читается только для запросов, которым нужна
+        yellowPages = &db.yellow_pages(); //Без копии: база живёт в CatalogHolder
+        for (const auto& p : yellowPages->rubrics()) 
             rubrics[p.first] = p.second.name();
 
         //Для построения маршрутов до компаний
-        for (size_t i = 0; i < yellowPages.companies_size(); ++i) {
-            const auto& company = yellowPages.companies()[i];
+        for (size_t i = 0; i < yellowPages->companies_size(); ++i) {
+            const auto& company = yellowPages->companies()[i];
             std::string companyName;
             for (const auto& name: company.names()) 
                 if (name.type() == 0){
@@ -232,95 +268,94 @@ public:
             if (company.rubrics_size())
                 fullName = rubrics[company.rubrics()[0]] + " " + companyName;
             companyFullNames.push_back(move(fullName));
+            companyNames.push_back(companyName);
             companyIdx[companyName] = i; //Move company name
-
-            //TODO перенести потом на этап создания базы
-            
-            workInt[companyName] = {};
-
-            const auto& workIntervals = company.working_time().intervals();
-            for (const auto& interval: workIntervals) {
-                uint32_t day = interval.day();
-                uint32_t start = interval.minutes_from();
-                uint32_t finish = interval.minutes_to();
-                if (day > 0) {
-                    start += (day - 1) * 24 * 60;
-                    finish += (day - 1) * 24 * 60;
-                    workInt[companyName].push_back({start, finish});
-                }
-                else 
-                    for (uint32_t d = 0; d < 7; ++d) {
-                        uint32_t localStart = start + d * 24 * 60;
-                        uint32_t localFinish = finish + d * 24 * 60;
-                        workInt[companyName].push_back({localStart, localFinish});
-                    }
-            }
-
-            if (workIntervals.empty()) {
-                workInt[companyName].push_back({0, 7*24*60});
-            }
-            sort(workInt[companyName].begin(), workInt[companyName].end());
+            schedules.push_back(WeeklySchedule::deserialize(db.company_schedules()[i]));
         }
     }
 
 
     void readOutputRequestsJson(const Json::Node& node) {
         const auto& allRequests = node.AsArray();
-        for (const auto& requestJson : allRequests) {
-            const auto& request = requestJson.AsMap();
-            const auto& type = request.at("type").AsString();
-            int id = request.at("id").AsInt();
-
-            if (type == "Map") {
-                requests.push_back({ RequestType::Map, id });
-            }
-            else if (type == "Route") {
-                std::string from = request.at("from").AsString();
-                std::string to = request.at("to").AsString();
-                requests.push_back({ RequestType::Route,  id, move(from), move(to) });
-            }
-            else if (type == "FindCompanies") {
-                FindCompanyRequest r {id};
-                parseCompanyRequest(r, request);
-                companyRequests.push_back(std::move(r));
-            }
-            else if (type == "RouteToCompany") {
-                RouteToCompanyRequest r{id};
-                r.from = request.at("from").AsString();  
-                const auto& compReq = request.at("companies").AsMap();
-                parseCompanyRequest(r, compReq);
+        statRequests.reserve(allRequests.size());
+        for (const auto& requestJson : allRequests)
+            if (auto request = parseStatRequest(requestJson.AsMap()))
+                statRequests.push_back(std::move(*request));
+    }
 
-                const auto& timeArr = request.at("datetime").AsArray();
-                r.currentTime = timeArr[2].AsInt() + timeArr[1].AsInt() * 60 
-                    + timeArr[0].AsInt() * 60 * 24;
+    //Запрос неизвестного типа пропускается (nullopt), как и раньше
+    static std::optional<AnyRequest> parseStatRequest(const Json::Dict& request) {
+        const auto type = request.at("type").AsString();
+        int id = request.at("id").AsInt();
+
+        if (type == "Map") 
+            return Request{ RequestType::Map, id, {}, {}, parseMapView(request) };
+        if (type == "Route") {
+            std::string from(request.at("from").AsString());
+            std::string to(request.at("to").AsString());
+            return Request{ RequestType::Route,  id, move(from), move(to) };
+        }
+        if (type == "FindCompanies") {
+            FindCompanyRequest r {id};
+            parseCompanyRequest(r, request);
+            return r;
+        }
+        if (type == "RouteToCompany") {
+            RouteToCompanyRequest r{id};
+            r.from = request.at("from").AsString();  
+            const auto& compReq = request.at("companies").AsMap();
+            parseCompanyRequest(r, compReq);
+
+            const auto& timeArr = request.at("datetime").AsArray();
+            r.currentTime = timeArr[2].AsInt() + timeArr[1].AsInt() * 60 
+                + timeArr[0].AsInt() * 60 * 24;
+            return r;
+        }
+        std::string name(request.at("name").AsString());
+        if (type == "Bus")
+            return Request{ RequestType::Bus,  id,  std::move(name) };
+        if (type == "Stop")
+            return Request{ RequestType::Stop, id, std::move(name) };
+        return std::nullopt;
+    }
 
-                routeToCompanyRequests.push_back(std::move(r));
-            }
-            else {
-                std::string name = request.at("name").AsString();
-                if (type == "Bus")
-                    requests.push_back({ RequestType::Bus,  id,  std::move(name) });
-                if (type == "Stop")
-                    requests.push_back({ RequestType::Stop, id, std::move(name) });
-            }
+    static MapView parseMapView(const Json::Dict& request) {
+        if (request.count("tile")) {
+            const auto& tile = request.at("tile").AsMap();
+            const int z = tile.at("z").AsInt(), x = tile.at("x").AsInt(), y = tile.at("y").AsInt();
+            if (z < 0 || z > 20 || x < 0 || y < 0 || x >= (1 << z) || y >= (1 << z))
+                return BadMapView{ "bad tile" };
+            MapTile t{ static_cast<uint32_t>(z), static_cast<uint32_t>(x), static_cast<uint32_t>(y) };
+            t.lod = request.count("lod") && request.at("lod").AsBool();
+            return t;
         }
+        if (request.count("bbox")) {
+            const auto& bbox = request.at("bbox").AsArray();
+            if (bbox.size() != 4)
+                return BadMapView{ "bad bbox" };
+            MapBox b{ bbox[0].AsDouble(), bbox[1].AsDouble(), bbox[2].AsDouble(), bbox[3].AsDouble() };
+            if (!(b.minX < b.maxX) || !(b.minY < b.maxY)) //Заодно отсекает nan
+                return BadMapView{ "bad bbox" };
+            return b;
+        }
+        return {};
     }
 
-    void parseCompanyRequest(FindCompanyRequest& r, const std::map<std::string, Json::Node>& request) {
+    static void parseCompanyRequest(FindCompanyRequest& r, const Json::Dict& request) {
         if (request.count("names")) {
             const auto& namesArr = request.at("names").AsArray();
             for (const auto& name: namesArr) 
-                r.names.push_back(name.AsString());
+                r.names.emplace_back(name.AsString());
         }
         if (request.count("urls")) {
             const auto& urlsArr = request.at("urls").AsArray();
             for (const auto& url: urlsArr) 
-                r.urls.push_back(url.AsString());
+                r.urls.emplace_back(url.AsString());
         }
         if (request.count("rubrics")) {
             const auto& rubricsArr = request.at("rubrics").AsArray();
             for (const auto& rubric: rubricsArr) 
-                r.rubrics.push_back(rubric.AsString());
+                r.rubrics.emplace_back(rubric.AsString());
         }
         if (request.count("phones")) {
             const auto& phonesArr = request.at("phones").AsArray();
@@ -328,7 +363,7 @@ public:
                 const auto& phoneMap = phone.AsMap();
                 Phone p;
                 if (phoneMap.count("type")) {
-                    const auto& t = phoneMap.at("type").AsString();
+                    const auto t = phoneMap.at("type").AsString();
                     if (t == "FAX")
                         p.type = 1;
                     else
@@ -351,7 +386,7 @@ public:
         const auto& allRequests = node.AsArray();
         for (const auto& r : allRequests) {
             const auto& request = r.AsMap();
-            const auto& type = request.at("type").AsString();
+            const auto type = request.at("type").AsString();
 
             if (type == "Stop")
                 readStopJson(request);
@@ -360,45 +395,42 @@ public:
         }
     }
 
-    void readStopJson(const std::map<std::string, Json::Node>& request) {
-        const auto& name = request.at("name").AsString();
+    void readStopJson(const Json::Dict& request) {
+        const std::string name(request.at("name").AsString());
         double lon = request.at("longitude").AsDouble();
         double lat = request.at("latitude").AsDouble();
 
-        std::map<std::string, Json::Node> distances;
+        DistanceMap distances;
         if (request.count("road_distances"))
-            distances = request.at("road_distances").AsMap();
+            for (const auto& [stopName, distance] : request.at("road_distances").AsMap())
+                distances[std::string(stopName)] = distance.AsDouble(); // Тут лежит int но мы его преобразуем к double при добавлении
+
+        addStop(name, { lat, lon }, std::move(distances));
+    }
+
 
+    void addStop(const std::string& name, Coordinates coords, DistanceMap distances) {
         stopStats[name] = {}; //Для того чтобы учитывать остановки без астобыусов
         size_t idx = stopsNames.size();
         stopsNames.push_back(name);
         stopsIdx[name] = idx;  //Для тщетной попытки построения графа
-
-        if (distances.empty())
-            stops[name] = { { lat, lon } };
-        else {
-            auto stopsDist = parseStopsDistanceJson(distances);
-            stops[name] = { { lat, lon },  stopsDist };
-        }
-        //Дистанции возможно простроить только если 
+        stops[name] = { coords, std::move(distances) };
     }
 
 
-    DistanceMap parseStopsDistanceJson(std::map<std::string, Json::Node>& distances) {
-        DistanceMap distMap;
-        for (const auto& d : distances)
-            distMap[d.first] = d.second.AsDouble(); // Тут лежит int но мы его преобразуем к double при добавлении
-        return distMap;
+    void readBusJson(const Json::Dict& request) {
+        std::string name(request.at("name").AsString());
+        std::vector<std::string> busStops;
+        for (const auto& s : request.at("stops").AsArray())
+            busStops.emplace_back(s.AsString());
+        addBus(name, std::move(busStops), request.at("is_roundtrip").AsBool());
     }
 
 
-    void readBusJson(const std::map<std::string, Json::Node>& request) {
-        std::string name = request.at("name").AsString();
+    void addBus(const std::string& name, std::vector<std::string> busStops, bool isCyclic) {
         BusRoute route;
-        route.isCyclic = request.at("is_roundtrip").AsBool();
-        const auto& stops = request.at("stops").AsArray();
-        for (const auto& s : stops)
-            route.stops.push_back(s.AsString());
+        route.isCyclic = isCyclic;
+        route.stops = std::move(busStops);
         if (route.stops.empty() == false)  
             route.endPoints.push_back(route.stops[0]);
         if (route.isCyclic == false && route.stops.size() >= 2) {
@@ -406,7 +438,7 @@ public:
             if (secondEndpoint != route.endPoints[0])
                 route.endPoints.push_back(secondEndpoint);
         }
-        routes[name] = route;
+        routes[name] = std::move(route);
     }
 
 
@@ -575,9 +607,7 @@ private:
     std::unordered_map<std::string, BusStats> busStats;
     std::unordered_map<std::string, StopStats> stopStats;
 
-    std::vector<Request> requests; //out
-    std::vector<FindCompanyRequest> companyRequests;
-    std::vector<RouteToCompanyRequest> routeToCompanyRequests;
+    std::vector<AnyRequest> statRequests; //out, в порядке stat_requests
 
     std::vector<std::string> stopsNames;
     std::unordered_map<std::string, size_t> stopsIdx;
@@ -591,20 +621,18 @@ private:
     //YellowPages
     
     std::unordered_map<uint64_t, std::string> rubrics;
-    YellowPages::Database yellowPages;
-    std::unordered_map<std::string, std::vector<std::pair<uint32_t, uint32_t>>> workInt;
+    const YellowPages::Database* yellowPages = nullptr; //Задаётся в deserializeYellowPages
+    std::vector<WeeklySchedule> schedules; //by company idx
 
 
 public:
 
     //Maybe const auto& all?
 
-    const std::vector<RouteToCompanyRequest>& getRouteToCompanyRequest() const { return routeToCompanyRequests;}
-    const std::vector<FindCompanyRequest>& getCompanyRequests() const { return companyRequests; }
     const std::unordered_map<uint64_t, std::string>& getRubrics() const { return rubrics; }
-    const YellowPages::Database& getYellowPages() const { return yellowPages; }
+    const YellowPages::Database& getYellowPages() const { return *yellowPages; }
 
-    const std::vector<Request>& getRequests() const { return requests; }
+    const std::vector<AnyRequest>& getStatRequests() const { return statRequests; }
     const std::unordered_map<std::string, BusStats>& getBusStats() const { return busStats;  }
     const std::unordered_map<std::string, StopStats>& getStopStats() const { return stopStats;  }
 
@@ -622,5 +650,307 @@ public:
     const auto& getCompanyNames() const { return companyNames; }
     const auto& getCompanyFullNames() const { return companyFullNames; }
 
-    const auto& getWorkIntervals() const { return workInt; }
-};
\ No newline at end of file
+    const auto& getSchedules() const { return schedules; }
+};
+
+
+
+//Потоковое чтение make_base: base_requests сразу попадают в Parser, деревом остаются только настройки
+class BaseRequestsHandler : public Json::Handler {
+
+public:
+
+    explicit BaseRequestsHandler(Parser& parser) : parser(parser) {}
+
+    void StartObject() override {
+        if (forwardToSettings(&Json::Handler::StartObject))
+            return;
+        ++depth;
+        if (skipDepth)
+            ++skipDepth;
+        else if (depth == 2 && inBaseRequests == false)
+            startSettings()->StartObject();
+        else if (depth == 3 && inBaseRequests)
+            request = {};
+        else if (depth == 4 && field == "road_distances")
+            inDistances = true;
+        else if (depth > 2)
+            ++skipDepth;
+    }
+
+    void Key(std::string_view key) override {
+        if (forwardToSettings(&Json::Handler::Key, key) || skipDepth)
+            return;
+        if (depth == 1)
+            topKey = key;
+        else if (depth == 3)
+            field = key;
+        else if (depth == 4 && inDistances)
+            distanceKey = key;
+    }
+
+    void EndObject() override {
+        if (forwardToSettings(&Json::Handler::EndObject))
+            return;
+        if (skipDepth)
+            --skipDepth;
+        else if (depth == 4)
+            inDistances = false;
+        else if (depth == 3 && inBaseRequests)
+            flushRequest();
+        --depth;
+    }
+
+    void StartArray() override {
+        if (forwardToSettings(&Json::Handler::StartArray))
+            return;
+        ++depth;
+        if (skipDepth)
+            ++skipDepth;
+        else if (depth == 2 && topKey == "base_requests")
+            inBaseRequests = true;
+        else if (depth == 2)
+            startSettings()->StartArray();
+        else if (depth == 4 && field == "stops")
+            inStops = true;
+        else if (depth > 2)
+            ++skipDepth;
+    }
+
+    void EndArray() override {
+        if (forwardToSettings(&Json::Handler::EndArray))
+            return;
+        if (skipDepth)
+            --skipDepth;
+        else if (depth == 4)
+            inStops = false;
+        else if (depth == 2)
+            inBaseRequests = false;
+        --depth;
+    }
+
+    void String(std::string_view value) override {
+        if (forwardToSettings(&Json::Handler::String, value) || skipDepth)
+            return;
+        if (depth == 1)
+            storeScalar(Json::Node(std::string(value)));
+        else if (depth == 4 && inStops)
+            request.stops.emplace_back(value);
+        else if (depth == 3 && field == "type")
+            request.type = value;
+        else if (depth == 3 && field == "name")
+            request.name = value;
+    }
+
+    void Int(int value) override {
+        if (forwardToSettings(&Json::Handler::Int, value) || skipDepth)
+            return;
+        if (depth == 1)
+            storeScalar(Json::Node(value));
+        else
+            readNumber(value);
+    }
+
+    void Double(double value) override {
+        if (forwardToSettings(&Json::Handler::Double, value) || skipDepth)
+            return;
+        if (depth == 1)
+            storeScalar(Json::Node(value));
+        else
+            readNumber(value);
+    }
+
+    void Bool(bool value) override {
+        if (forwardToSettings(&Json::Handler::Bool, value) || skipDepth)
+            return;
+        if (depth == 1)
+            storeScalar(Json::Node(value));
+        else if (depth == 3 && field == "is_roundtrip")
+            request.isCyclic = value;
+    }
+
+    void Null() override {
+        if (forwardToSettings(&Json::Handler::Null) == false && depth == 1)
+            storeScalar(Json::Node(nullptr));
+    }
+
+
+    const Json::Dict& getSettings() const { return settings; }
+
+private:
+
+    struct BaseRequest {
+        std::string type;
+        std::string name;
+        Coordinates coords{};
+        DistanceMap distances;
+        std::vector<std::string> stops;
+        bool isCyclic = false;
+    };
+
+    void readNumber(double value) {
+        if (depth == 4 && inDistances)
+            request.distances[distanceKey] = value;
+        else if (depth == 3 && field == "latitude")
+            request.coords.lat = value;
+        else if (depth == 3 && field == "longitude")
+            request.coords.lon = value;
+    }
+
+    template <typename... Args>
+    bool forwardToSettings(void (Json::Handler::*event)(Args...), Args... args) {
+        if (settingsBuilder == nullptr)
+            return false;
+        (settingsBuilder.get()->*event)(args...);
+        if (settingsBuilder->IsComplete()) {
+            settings[topKey] = settingsBuilder->TakeRoot();
+            settingsBuilder.reset();
+            --depth;
+        }
+        return true;
+    }
+
+    Json::NodeBuilder* startSettings() {
+        settingsBuilder = std::make_unique<Json::NodeBuilder>();
+        return settingsBuilder.get();
+    }
+
+    void storeScalar(Json::Node node) {
+        settings[topKey] = std::move(node);
+    }
+
+    void flushRequest() {
+        if (request.type == "Stop")
+            parser.addStop(request.name, request.coords, std::move(request.distances));
+        else if (request.type == "Bus")
+            parser.addBus(request.name, std::move(request.stops), request.isCyclic);
+    }
+
+    Parser& parser;
+    Json::Dict settings;
+    std::unique_ptr<Json::NodeBuilder> settingsBuilder;
+
+    int depth = 0;
+    int skipDepth = 0;
+    bool inBaseRequests = false;
+    bool inDistances = false;
+    bool inStops = false;
+    std::string topKey;
+    std::string field;
+    std::string distanceKey;
+    BaseRequest request;
+};
+
+
+
+//Потоковое чтение process_requests: каждый элемент stat_requests отдаётся наружу, как только он разобран
+class StatRequestsHandler : public Json::Handler {
+
+public:
+
+    using RequestCallback = std::function<void(AnyRequest)>;
+    using SettingCallback = std::function<void(const std::string&, const Json::Node&)>;
+
+    StatRequestsHandler(RequestCallback onRequest, SettingCallback onSetting) 
+        : onRequest(std::move(onRequest)), onSetting(std::move(onSetting)) {}
+
+    void StartObject() override {
+        if (forward(&Json::Handler::StartObject))
+            return;
+        ++depth;
+        if (depth == 2 || (depth == 3 && inStatRequests))
+            startBuilder()->StartObject();
+    }
+
+    void Key(std::string_view key) override {
+        if (forward(&Json::Handler::Key, key) == false && depth == 1)
+            topKey = key;
+    }
+
+    void EndObject() override {
+        if (forward(&Json::Handler::EndObject) == false)
+            --depth;
+    }
+
+    void StartArray() override {
+        if (forward(&Json::Handler::StartArray))
+            return;
+        ++depth;
+        if (depth == 2 && topKey == "stat_requests")
+            inStatRequests = true;
+        else if (depth == 2)
+            startBuilder()->StartArray();
+    }
+
+    void EndArray() override {
+        if (forward(&Json::Handler::EndArray))
+            return;
+        if (depth == 2)
+            inStatRequests = false;
+        --depth;
+    }
+
+    void String(std::string_view value) override {
+        if (forward(&Json::Handler::String, value) == false)
+            storeScalar(Json::Node(std::string(value)));
+    }
+
+    void Int(int value) override {
+        if (forward(&Json::Handler::Int, value) == false)
+            storeScalar(Json::Node(value));
+    }
+
+    void Double(double value) override {
+        if (forward(&Json::Handler::Double, value) == false)
+            storeScalar(Json::Node(value));
+    }
+
+    void Bool(bool value) override {
+        if (forward(&Json::Handler::Bool, value) == false)
+            storeScalar(Json::Node(value));
+    }
+
+    void Null() override {
+        if (forward(&Json::Handler::Null) == false)
+            storeScalar(Json::Node(nullptr));
+    }
+
+private:
+
+    template <typename... Args>
+    bool forward(void (Json::Handler::*event)(Args...), Args... args) {
+        if (builder == nullptr)
+            return false;
+        (builder.get()->*event)(args...);
+        if (builder->IsComplete()) {
+            Json::Node root = builder->TakeRoot();
+            builder.reset();
+            --depth;
+            if (inStatRequests) {
+                if (auto request = Parser::parseStatRequest(root.AsMap()))
+                    onRequest(std::move(*request));
+            }
+            else
+                onSetting(topKey, root);
+        }
+        return true;
+    }
+
+    Json::NodeBuilder* startBuilder() {
+        builder = std::make_unique<Json::NodeBuilder>();
+        return builder.get();
+    }
+
+    void storeScalar(Json::Node node) {
+        if (depth == 1)
+            onSetting(topKey, node);
+    }
+
+    RequestCallback onRequest;
+    SettingCallback onSetting;
+    std::unique_ptr<Json::NodeBuilder> builder;
+
+    int depth = 0;
+    bool inStatRequests = false;
+    std::string topKey;
+};
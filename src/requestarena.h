@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+
+//Память одного запроса: всё, что строится для ответа, берётся отсюда и освобождается разом в reset
+class RequestArena {
+
+public:
+
+    explicit RequestArena(size_t initialSize = 64 * 1024) {
+        grow(initialSize);
+    }
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    std::pmr::memory_resource* get() { return &*arena; }
+
+    void reset() { //Если запрос не уместился, буфер растёт, и следующие обходятся без глобального аллокатора
+        const size_t overflow = upstream.allocated;
+        arena.reset();
+        upstream.allocated = 0;
+        if (overflow)
+            grow(bufferSize + overflow);
+        else
+            arena.emplace(buffer.get(), bufferSize, &upstream);
+    }
+
+private:
+
+    class CountingResource : public std::pmr::memory_resource {
+    public:
+        size_t allocated = 0;
+
+    private:
+        void* do_allocate(size_t bytes, size_t alignment) override {
+            allocated += bytes;
+            return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+            std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    void grow(size_t size) {
+        arena.reset();
+        bufferSize = size;
+        buffer = std::make_unique<std::byte[]>(bufferSize);
+        arena.emplace(buffer.get(), bufferSize, &upstream);
+    }
+
+    CountingResource upstream;
+    std::unique_ptr<std::byte[]> buffer;
+    size_t bufferSize = 0;
+    std::optional<std::pmr::monotonic_buffer_resource> arena;
+};
+
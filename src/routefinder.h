@@ -6,20 +6,48 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <cstdint>
+#include <stdexcept>
 
 #include "transport_catalog.pb.h"
 
 
 
-struct EdgeAction {
-    std::string type;
-    double time;
-    std::string name;
+enum class ActionType : uint8_t {
+    WaitBus,
+    RideBus,
+    WalkToCompany
+};
+
+
+inline std::string_view actionTypeName(ActionType type) {
+    static constexpr std::string_view names[] = { "WaitBus", "RideBus", "WalkToCompany" };
+    return names[static_cast<size_t>(type)];
+}
+
+
+struct EdgeAction { //Строки не копируются: имена указывают на строки Parser, которые живут всё время работы
+    ActionType type;
     unsigned int spans;
-    std::string companyName = ""; //Adaptation for part S
+    double time;
+    const std::string* name; //Остановка, у RideBus - автобус
+    const std::string* companyName = nullptr; //Adaptation for part S
 };
 
+struct EdgeRecord { //Ребро графа в базе: вместо имён номера, поэтому массив записывается и читается целиком
+    ActionType type;
+    uint8_t reserved[3]; //Выравнивание явно и нулями, чтобы файл базы не зависел от мусора в памяти
+    uint32_t spans;
+    uint32_t name; //Номер остановки, у RideBus - автобуса в порядке Parser::getRoutes()
+    uint32_t company;
+    double time;
+};
+
+static_assert(sizeof(EdgeRecord) == 24, "EdgeRecord is written byte for byte: no implicit padding");
+
+
 struct RouteAction { //Возможно стоит вынести эту структуру отдельно, чтобы не подключать в maprender.h всю
     bool notFound;
     double totalTime;
@@ -59,12 +87,27 @@ public:
         routeAction.notFound = false;
         routeAction.finalStop = to;
 
-        std::vector<EdgeAction> routeActions;
         auto id = foundRoute.value().id;
 
+        const auto& stopNames = parser.getStopNames();
+        const auto& companyNames = parser.getCompanyNames();
+        routeAction.actions.reserve(foundRoute.value().edge_count);
         for (size_t i = 0; i < foundRoute.value().edge_count; ++i) {
-            auto edgeIdx = router->GetRouteEdge(id, i);
-            routeAction.actions.push_back(edgeActions[edgeIdx]);
+            const auto& record = edgeRecords[router->GetRouteEdge(id, i)];
+            EdgeAction action{ record.type, record.spans, record.time, nullptr };
+            switch (record.type) { //У RideBus в name номер автобуса, а не остановки
+            case ActionType::RideBus:
+                action.name = busNames[record.name];
+                break;
+            case ActionType::WalkToCompany:
+                action.name = &stopNames[record.name];
+                action.companyName = &companyNames[record.company];
+                break;
+            case ActionType::WaitBus:
+                action.name = &stopNames[record.name];
+                break;
+            }
+            routeAction.actions.push_back(action);
         }
 
         routeAction.totalTime = foundRoute.value().weight;
@@ -84,19 +127,19 @@ public:
         db.set_bus_wait_time(busWaitTime);
 
         const auto& stopsNames = parser.getStopNames();
-        for (size_t i = 0; i < stopsNames.size(); ++i) 
+        for (uint32_t i = 0; i < stopsNames.size(); ++i) {
             graph.AddEdge(Graph::Edge<double>{ 2 * i, 2 * i + 1, busWaitTime});
+            edgeRecords.push_back(EdgeRecord{ ActionType::WaitBus, {}, 0, i, 0, busWaitTime });
+        }
 
         const auto& routes = parser.getRoutes();
         const auto& stopsIdx = parser.getStopsIdx();
         const auto& stopsDist = parser.getStopsDist();
 
+        uint32_t busIdx = 0; //Номер автобуса - порядок в getRoutes()
         for (const auto& [busName, bus] : routes) {
             const auto& busStops = bus.stops;
 
-            auto busSerial = db.add_bus_edges();
-            busSerial->set_bus_name(busName);
-
             for (size_t i = 0; i < busStops.size(); ++i) { //TODO внутренность в функцию
                 double totalTime{};
                 unsigned int spanCount{};
@@ -106,11 +149,7 @@ public:
                     totalTime += stopsDist.at(idx1).at(idx2) / (busVelocity * 1000 / 60); 
                     graph.AddEdge(Graph::Edge<double>{ 2 * stopsIdx.at(busStops[i]) + 1, 2 * idx2, totalTime });
                     ++spanCount;
-                    auto element = busSerial->add_elements();
-                    element->set_total_time(totalTime);
-                    element->set_spans_count(spanCount);
-                    element->set_idx1(2 * stopsIdx.at(busStops[i]) + 1);
-                    element->set_idx2(2 * idx2);
+                    edgeRecords.push_back(EdgeRecord{ ActionType::RideBus, {}, spanCount, busIdx, 0, totalTime });
                 }
             }
 
@@ -124,74 +163,63 @@ public:
                         totalTime += stopsDist.at(idx2).at(idx1) / (busVelocity * 1000 / 60); 
                         graph.AddEdge(Graph::Edge<double>{ 2 * stopsIdx.at(busStops[i]) + 1, 2 * idx1, totalTime });
                         ++spanCount;
-                        auto element = busSerial->add_elements();
-                        element->set_total_time(totalTime);
-                        element->set_spans_count(spanCount);
-                        element->set_idx1(2 * stopsIdx.at(busStops[i]) + 1);
-                        element->set_idx2(2 * idx1);
+                        edgeRecords.push_back(EdgeRecord{ ActionType::RideBus, {}, spanCount, busIdx, 0, totalTime });
                     }
                 }
+            ++busIdx;
         }
 
-        const auto& companyNames = parser.getCompanyNames();
-        for (size_t i = 0; i < db.yellow_pages().companies_size(); ++i) {
+        const uint32_t companyCount = db.yellow_pages().companies_size();
+        for (uint32_t i = 0; i < companyCount; ++i) {
             const auto& company = db.yellow_pages().companies()[i];
             size_t companyIdx = 2 * parser.getStopsSize() + i;
-            const auto& companyName = companyNames[i];
-            auto companySer = db.add_company_edges();
-            companySer->set_company_name(companyName);
             for (const auto& stop: company.nearby_stops()) {
-                size_t stopIdx = stopsIdx.at(stop.name()) * 2;
+                const uint32_t stopIdx = stopsIdx.at(stop.name());
                 double time = stop.meters() / (pedestrianVelocity * 1000 / 60);
-                graph.AddEdge(Graph::Edge<double>{ stopIdx, companyIdx, time });
-                auto element = companySer->add_elements();
-                element->set_total_time(time);
-                element->set_idx1(stopIdx); 
-                element->set_idx2(companyIdx);
+                graph.AddEdge(Graph::Edge<double>{ 2 * stopIdx, companyIdx, time });
+                edgeRecords.push_back(EdgeRecord{ ActionType::WalkToCompany, {}, 0, stopIdx, i, time });
             }
         }
 
         router = std::make_unique<Graph::Router<double>>(graph);
         auto r = db.mutable_router();
         router->Serialize(*r->mutable_router());
+        graph.Serialize(*r->mutable_graph());
+        Graph::WriteFlat(*r->mutable_edge_records(), edgeRecords);
     }
 
 
-    void deserialize(const Parser& parser, Database::TransportCatalog& db) {
+    void deserialize(const Parser& parser, Database::TransportCatalog& db) { //Граф и метаданные рёбер копируются из базы целиком
 
         busWaitTime = db.bus_wait_time();
-        auto graphSize = 2 * parser.getStopsSize() + db.yellow_pages().companies_size();
-        graph = BusGraph(graphSize);
-
-        const auto& stopsNames = parser.getStopNames();
-        for (size_t i = 0; i < stopsNames.size(); ++i) {
-            graph.AddEdge(Graph::Edge<double>{ 2 * i, 2 * i + 1, busWaitTime});
-            edgeActions.push_back(EdgeAction{ "WaitBus", busWaitTime, stopsNames[i], 0 });
-        }
-
-        for (const auto& busEdge: db.bus_edges()) {
-            const auto& busName = busEdge.bus_name();
-            for (const auto& element: busEdge.elements()) {
-                graph.AddEdge(Graph::Edge<double>{element.idx1(), 
-                    element.idx2(), element.total_time() });
-                edgeActions.push_back(EdgeAction{ "RideBus", element.total_time(), 
-                    busName, element.spans_count() });
-            }
-        }
-
-        const auto& stopNames = parser.getStopNames();
-        for (const auto& companyEdge: db.company_edges()) {
-            const auto& companyName = companyEdge.company_name();
-            for (const auto& element: companyEdge.elements()) {
-                const auto& stopName = stopNames[element.idx1()/2];
-                graph.AddEdge(Graph::Edge<double>{element.idx1(), 
-                    element.idx2(), element.total_time() });
-                edgeActions.push_back(EdgeAction{ "WalkToCompany", element.total_time(), 
-                    stopName, 0, companyName });
+        const auto& proto = db.router();
+        graph = BusGraph::Deserialize(proto.graph());
+        edgeRecords = Graph::ReadFlat<EdgeRecord>(proto.edge_records());
+        if (edgeRecords.size() != graph.GetEdgeCount())
+            throw std::runtime_error("Broken route graph in database: edge records don't match edges");
+
+        for (const auto& [busName, _] : parser.getRoutes())
+            busNames.push_back(&busName);
+
+        const size_t stopCount = parser.getStopNames().size();
+        const size_t companyCount = parser.getCompanyNames().size();
+        for (const auto& record : edgeRecords) { //Номера имён проверяются один раз здесь, а не при каждом поиске маршрута
+            bool valid = false;
+            switch (record.type) {
+            case ActionType::RideBus:
+                valid = record.name < busNames.size();
+                break;
+            case ActionType::WalkToCompany:
+                valid = record.name < stopCount && record.company < companyCount;
+                break;
+            case ActionType::WaitBus:
+                valid = record.name < stopCount;
+                break;
             }
+            if (valid == false)
+                throw std::runtime_error("Broken route graph in database: edge record refers to unknown name");
         }
 
-        auto& proto = db.router();
         router = Router::Deserialize(proto.router(), graph);
     }
 
@@ -211,6 +239,6 @@ private:
 
     BusGraph graph;
     std::unique_ptr<Graph::Router<double>> router{ nullptr };
-    std::vector<EdgeAction> edgeActions;
-    size_t waitEdgeBorder; //Для сериализации
+    std::vector<EdgeRecord> edgeRecords; //По номеру ребра графа
+    std::vector<const std::string*> busNames; //Номер автобуса из EdgeRecord -> имя
 };
\ No newline at end of file
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "working_time.pb.h"
+#include "transport_catalog.pb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+
+//Часы работы компании: слитые и упорядоченные интервалы в минутах от начала недели
+class WeeklySchedule {
+
+public:
+
+    static constexpr uint32_t MINUTES_IN_DAY = 24 * 60;
+    static constexpr uint32_t MINUTES_IN_WEEK = 7 * MINUTES_IN_DAY;
+
+
+    static WeeklySchedule build(const YellowPages::WorkingTime& workingTime) {
+        std::vector<std::pair<uint32_t, uint32_t>> intervals;
+        for (const auto& interval: workingTime.intervals()) {
+            uint32_t day = interval.day();
+            uint32_t start = interval.minutes_from();
+            uint32_t finish = std::max(interval.minutes_to(), interval.minutes_from());
+            if (day > 0)
+                intervals.push_back({start + (day - 1) * MINUTES_IN_DAY, finish + (day - 1) * MINUTES_IN_DAY});
+            else
+                for (uint32_t d = 0; d < 7; ++d)
+                    intervals.push_back({start + d * MINUTES_IN_DAY, finish + d * MINUTES_IN_DAY});
+        }
+        if (intervals.empty())
+            intervals.push_back({0, MINUTES_IN_WEEK});
+        std::sort(intervals.begin(), intervals.end());
+
+        WeeklySchedule schedule;
+        for (const auto& [start, finish]: intervals) {
+            if (schedule.closes.empty() == false && start <= schedule.closes.back()) {
+                schedule.closes.back() = std::max(schedule.closes.back(), finish);
+                continue;
+            }
+            schedule.opens.push_back(start);
+            schedule.closes.push_back(finish);
+        }
+        return schedule;
+    }
+
+
+    void serialize(Database::CompanySchedule& proto) const {
+        for (size_t i = 0; i < opens.size(); ++i) {
+            proto.add_opens(opens[i]);
+            proto.add_closes(closes[i]);
+        }
+    }
+
+
+    static WeeklySchedule deserialize(const Database::CompanySchedule& proto) {
+        WeeklySchedule schedule;
+        schedule.opens.assign(proto.opens().begin(), proto.opens().end());
+        schedule.closes.assign(proto.closes().begin(), proto.closes().end());
+        return schedule;
+    }
+
+
+    double waitTime(double now) const { //Минуты до открытия, с переходом через конец недели
+        if (auto wait = waitInsideWeek(now))
+            return *wait;
+        double tillTheEnd = MINUTES_IN_WEEK - now;
+        if (tillTheEnd < 0) {
+            now = -tillTheEnd;
+            tillTheEnd = 0;
+        }
+        else
+            now = 0;
+        return waitInsideWeek(now).value_or(0) + tillTheEnd;
+    }
+
+private:
+
+    std::optional<double> waitInsideWeek(double now) const {
+        auto it = std::upper_bound(closes.begin(), closes.end(), now);
+        if (it == closes.end())
+            return std::nullopt;
+        double open = opens[it - closes.begin()];
+        if (now >= open)
+            return 0;
+        return open - now;
+    }
+
+    std::vector<uint32_t> opens;
+    std::vector<uint32_t> closes;
+};
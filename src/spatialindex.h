@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+
+struct Box {
+    double minX, minY, maxX, maxY;
+
+    bool intersects(const Box& other) const {
+        return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+    }
+};
+
+
+//Равномерная сетка поверх холста: элемент попадает во все ячейки, которые задевает его рамка.
+//Всё, что за границей сетки, складывается в крайние ячейки
+template <typename Item>
+class SpatialGrid {
+
+public:
+
+    SpatialGrid(Box bounds, size_t cellsPerSide)
+        : bounds(bounds), cellsPerSide(cellsPerSide), cells(cellsPerSide * cellsPerSide)
+    {
+        cellWidth = std::max((bounds.maxX - bounds.minX) / cellsPerSide, 1e-9);
+        cellHeight = std::max((bounds.maxY - bounds.minY) / cellsPerSide, 1e-9);
+    }
+
+    void insert(const Box& box, Item item) {
+        const auto range = cellRange(box);
+        for (size_t r = range.firstRow; r <= range.lastRow; ++r)
+            for (size_t c = range.firstColumn; c <= range.lastColumn; ++c)
+                cells[r * cellsPerSide + c].push_back(item);
+    }
+
+    //Кандидаты без повторов и по возрастанию; точную проверку пересечения делает вызывающий
+    void query(const Box& box, std::vector<Item>& found) const {
+        found.clear();
+        const auto range = cellRange(box);
+        for (size_t r = range.firstRow; r <= range.lastRow; ++r)
+            for (size_t c = range.firstColumn; c <= range.lastColumn; ++c) {
+                const auto& cell = cells[r * cellsPerSide + c];
+                found.insert(found.end(), cell.begin(), cell.end());
+            }
+        std::sort(found.begin(), found.end());
+        found.erase(std::unique(found.begin(), found.end()), found.end());
+    }
+
+private:
+
+    struct CellRange {
+        size_t firstRow, lastRow;
+        size_t firstColumn, lastColumn;
+    };
+
+    size_t cellIndex(double value, double origin, double cellSize) const {
+        const double idx = std::floor((value - origin) / cellSize);
+        return static_cast<size_t>(std::clamp(idx, 0.0, static_cast<double>(cellsPerSide - 1)));
+    }
+
+    CellRange cellRange(const Box& box) const {
+        return { cellIndex(box.minY, bounds.minY, cellHeight), cellIndex(box.maxY, bounds.minY, cellHeight),
+            cellIndex(box.minX, bounds.minX, cellWidth), cellIndex(box.maxX, bounds.minX, cellWidth) };
+    }
+
+    Box bounds;
+    size_t cellsPerSide;
+    double cellWidth;
+    double cellHeight;
+    std::vector<std::vector<Item>> cells;
+};
@@ -3,17 +3,97 @@
 #include <cstdint>
 #include <variant>
 #include <string>
-#include <iostream>
-#include <memory>
+#include <charconv>
+#include <memory_resource>
+#include <type_traits>
 #include <vector>
-#include <optional>
+#include <memory>
 #include <utility>
+#include <iterator>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <optional>
 
 #include "profile.h"
 
 
 namespace Svg {
 
+	class StyleSheet;
+
+	struct NumberFormat { //general - значащие цифры, как ostream с setprecision; fixed - знаки после точки
+		int digits = 10;
+		bool fixed = false;
+	};
+
+	class Output { //svg пишется прямо в буфер, числа через to_chars вместо ostream
+	public:
+		explicit Output(std::pmr::string& buffer, NumberFormat format = {}, const StyleSheet* styles = nullptr) 
+			: buffer(buffer), format(format), styles(styles) {}
+
+		Output& operator<<(std::string_view text) {
+			buffer.append(text);
+			return *this;
+		}
+
+		Output& operator<<(char c) {
+			buffer.push_back(c);
+			return *this;
+		}
+
+		Output& operator<<(double value) {
+			Write(value, format);
+			return *this;
+		}
+
+		Output& General(double value) { //Не координата и не длина (прозрачность, viewBox) - без svg_precision
+			Write(value, NumberFormat{});
+			return *this;
+		}
+
+		template <typename Integer, std::enable_if_t<std::is_integral_v<Integer>, int> = 0>
+		Output& operator<<(Integer value) {
+			char chars[24];
+			const auto result = std::to_chars(chars, chars + sizeof(chars), value);
+			buffer.append(chars, result.ptr - chars);
+			return *this;
+		}
+
+		NumberFormat GetFormat() const { return format; }
+		const StyleSheet* GetStyles() const { return styles; } //Задана - компактный вывод через css-классы
+
+	private:
+		void Write(double value, NumberFormat numberFormat) {
+			char chars[128];
+			auto result = std::to_chars(chars, chars + sizeof(chars), value,
+				numberFormat.fixed ? std::chars_format::fixed : std::chars_format::general, numberFormat.digits);
+			if (result.ec != std::errc{}) { //Не влезло (огромное число с десятками знаков) - кратчайшая точная запись
+				result = std::to_chars(chars, chars + sizeof(chars), value);
+				buffer.append(chars, result.ptr - chars);
+				return;
+			}
+			std::string_view text(chars, result.ptr - chars);
+			if (numberFormat.fixed)
+				TrimFixed(text);
+			buffer.append(text);
+		}
+
+		static void TrimFixed(std::string_view& text) { //Без хвостовых нулей: 12.50 -> 12.5, 3.00 -> 3, -0.00 -> 0
+			if (text.find('.') != std::string_view::npos) {
+				text.remove_suffix(text.size() - text.find_last_not_of('0') - 1);
+				if (text.back() == '.')
+					text.remove_suffix(1);
+			}
+			if (text == "-0")
+				text = "0";
+		}
+
+		std::pmr::string& buffer;
+		NumberFormat format;
+		const StyleSheet* styles;
+	};
+
 	struct Rgb {
 		uint8_t red;
 		uint8_t green;
@@ -27,77 +107,82 @@ namespace Svg {
 	using Color = std::variant<std::monostate, std::string, Rgb, Rgba>;
 	const Color NoneColor{};
 
-	void RenderColor(std::ostream& os, std::monostate) {
+	void RenderColor(Output& os, std::monostate) {
 		os << "none";
 	}
 
-	void RenderColor(std::ostream& os, std::string str) {
+	void RenderColor(Output& os, const std::string& str) {
 		os << str; 
 	}
 
-	void RenderColor(std::ostream& os, Rgb rgb) {
+	void RenderColor(Output& os, Rgb rgb) {
 		os << "rgb(" << static_cast<int>(rgb.red) << ","
 			<< static_cast<int>(rgb.green) << ","
 			<< static_cast<int>(rgb.blue) << ")";
 	}
 
-	void RenderColor(std::ostream& os, Rgba rgba) {
+	void RenderColor(Output& os, Rgba rgba) {
 		os << "rgba(" << static_cast<int>(rgba.red) << ","
 			<< static_cast<int>(rgba.green) << ","
-			<< static_cast<int>(rgba.blue) << ","
-			<< rgba.opacity << ")";
+			<< static_cast<int>(rgba.blue) << ",";
+		os.General(rgba.opacity) << ")";
 	}
 
-	void RenderColor(std::ostream& os, const Color& color) {
+	void RenderColor(Output& os, const Color& color) {
 		std::visit([&os](const auto& value) {RenderColor(os, value); }, color);
 	}
 
-	class SvgObject {
-	public: 
-		virtual void Render(std::ostream& os) const = 0;
-		virtual ~SvgObject() = default;
+	struct Point {
+		double x, y;
+		Point() : x(0), y(0) {}
+		Point(double x, double y) : x(x), y(y) {}
 	};
 
-	class Document : public SvgObject {
+	class Document;
+
+	class StyleSheet { //Наборы стилей объектов в виде css-классов: объект со стилем из таблицы пишет только class="sN"
 	public:
-		template <typename ObjectType>
-		void Add(ObjectType object) {
-			objects.push_back(std::make_unique<ObjectType>(std::move(object)));
+		StyleSheet() = default;
+		StyleSheet(const StyleSheet&) = delete; //index ссылается на строки styles
+		StyleSheet& operator=(const StyleSheet&) = delete;
+
+		void Reset(NumberFormat value) {
+			format = value;
+			index.clear();
+			styles.clear();
 		}
 
-		void Render(std::ostream& os) const override {
-			LOG_PROFILE("Render"); //TODO найти способ оптимизации
-			os << "<?xml version=\\\"1.0\\\" encoding=\\\"UTF-8\\\" ?>";
-			os << "<svg xmlns=\\\"http://www.w3.org/2000/svg\\\" version=\\\"1.1\\\">"; 
-			for (const auto& objectPtr : objects)
-				objectPtr->Render(os);
-			os << "</svg>";
+		void Add(const Document& doc);
+
+		void AddStyle(std::string_view style) { //Номер класса - порядок первого появления
+			if (index.count(style) == 0) {
+				styles.emplace_back(style);
+				index.emplace(styles.back(), styles.size() - 1);
+			}
 		}
 
-		void RenderNoStart(std::ostream& os) const {
-			LOG_PROFILE("RenderNoStart");
-			for (const auto& objectPtr : objects)
-				objectPtr->Render(os);
-			os << "</svg>";
+		std::optional<size_t> Find(std::string_view style) const {
+			if (const auto it = index.find(style); it != index.end())
+				return it->second;
+			return std::nullopt;
 		}
 
-		void RenderNoEnd(std::ostream& os) const {
-			LOG_PROFILE("RenderNoEnd");
-			os << "<?xml version=\\\"1.0\\\" encoding=\\\"UTF-8\\\" ?>";
-			os << "<svg xmlns=\\\"http://www.w3.org/2000/svg\\\" version=\\\"1.1\\\">"; 
-			for (const auto& objectPtr : objects)
-				objectPtr->Render(os);
+		void Render(Output& os) const {
+			if (styles.empty())
+				return;
+			os << "<defs><style>";
+			for (size_t i = 0; i < styles.size(); ++i)
+				os << ".s" << i << "{" << styles[i] << "}";
+			os << "</style></defs>";
 		}
 
+		NumberFormat GetFormat() const { return format; } //Числа в стилях всегда в этом формате, чтобы ключ не зависел от вывода
+		const std::deque<std::string>& GetStyles() const { return styles; }
 
 	private:
-		std::vector<std::shared_ptr<SvgObject>> objects; //����� ���� unique_ptr
-	};
-
-	struct Point {
-		double x, y;
-		Point() : x(0), y(0) {}
-		Point(double x, double y) : x(x), y(y) {}
+		NumberFormat format;
+		std::deque<std::string> styles;
+		std::unordered_map<std::string_view, size_t> index;
 	};
 
 	template <typename Child>
@@ -116,28 +201,59 @@ namespace Svg {
 			strokeWidth = value;
 			return returnChild();
 		}
-		Child& SetStrokeLineCap(const std::string& value) {
+		//Стили хранятся видом без копии и без общего пула: строка должна жить дольше объекта, обычно это литерал
+		Child& SetStrokeLineCap(std::string_view value) {
 			strokeLineCap = value;
 			return returnChild();
 		}
-		Child& SetStrokeLineJoin(const std::string& value) {
+		Child& SetStrokeLineJoin(std::string_view value) {
 			strokeLineJoin = value;
 			return returnChild();
 		}
+
+		double GetStrokeWidth() const { return strokeWidth; }
 		
-		void RenderProperties(std::ostream& os) const {
+		void RenderProperties(Output& os) const {
 			//LOG_PROFILE("RenderProperties");
-			os << "fill=\\\"";
+			os << "fill=\"";
 			RenderColor(os, fillColor);
-			os << "\\\" ";
-			os << "stroke=\\\"";
+			os << "\" ";
+			os << "stroke=\"";
 			RenderColor(os, strokeColor);
-			os << "\\\" ";
-			os << "stroke-width=\\\"" << strokeWidth << "\\\" ";
-			if (strokeLineCap != std::nullopt)
-				os << "stroke-linecap=\\\"" << strokeLineCap.value() << "\\\" ";
-			if (strokeLineJoin != std::nullopt)
-				os << "stroke-linejoin=\\\"" << strokeLineJoin.value() << "\\\" ";
+			os << "\" ";
+			os << "stroke-width=\"" << strokeWidth << "\" ";
+			if (strokeLineCap.data())
+				os << "stroke-linecap=\"" << strokeLineCap << "\" ";
+			if (strokeLineJoin.data())
+				os << "stroke-linejoin=\"" << strokeLineJoin << "\" ";
+		}
+
+		void RenderStyle(Output& os) const { //То же, что RenderProperties, в виде css
+			os << "fill:";
+			RenderColor(os, fillColor);
+			os << ";stroke:";
+			RenderColor(os, strokeColor);
+			os << ";stroke-width:" << strokeWidth << "px";
+			if (strokeLineCap.data())
+				os << ";stroke-linecap:" << strokeLineCap;
+			if (strokeLineJoin.data())
+				os << ";stroke-linejoin:" << strokeLineJoin;
+		}
+
+		bool RenderClass(Output& os) const { //false - стиля нет в таблице (или вывод не компактный), пишутся атрибуты
+			const auto styles = os.GetStyles();
+			if (styles == nullptr)
+				return false;
+			char stack[256];
+			std::pmr::monotonic_buffer_resource arena(stack, sizeof(stack));
+			std::pmr::string style(&arena);
+			Output styleOs(style, styles->GetFormat());
+			static_cast<const Child&>(*this).RenderStyle(styleOs);
+			const auto id = styles->Find(style);
+			if (id.has_value() == false)
+				return false;
+			os << "class=\"s" << *id << "\" ";
+			return true;
 		}
 
 	protected:
@@ -145,8 +261,8 @@ namespace Svg {
 		Color strokeColor;
 		double strokeWidth = 1;
 
-		std::optional<std::string> strokeLineCap;
-		std::optional<std::string> strokeLineJoin;
+		std::string_view strokeLineCap; //Пустой data() - атрибут не задан
+		std::string_view strokeLineJoin;
 
 		Child& returnChild() {
 			return static_cast<Child&>(*this);
@@ -155,16 +271,17 @@ namespace Svg {
 	};
 
 	
-	class Circle : public SvgObject, public ObjectProps<Circle> {
+	class Circle : public ObjectProps<Circle> {
 	public:
 
-		void Render(std::ostream& os) const override {
+		void Render(Output& os) const {
 			//LOG_PROFILE("Render::Circle");
 			os << "<circle ";
-			os << "cx=\\\"" << center.x << "\\\" ";
-			os << "cy=\\\"" << center.y << "\\\" ";
-			os << "r=\\\"" << radius << "\\\" ";
-			RenderProperties(os);
+			os << "cx=\"" << center.x << "\" ";
+			os << "cy=\"" << center.y << "\" ";
+			os << "r=\"" << radius << "\" ";
+			if (RenderClass(os) == false)
+				RenderProperties(os);
 			os << "/>";
 		}
 
@@ -178,6 +295,9 @@ namespace Svg {
 			return *this;
 		}
 
+		Point GetCenter() const { return center; }
+		double GetRadius() const { return radius; }
+
 	protected:
 		Point center;
 		double radius = 1.0;
@@ -185,16 +305,17 @@ namespace Svg {
 
 
 	
-	class Polyline : public SvgObject, public ObjectProps<Polyline> {
+	class Polyline : public ObjectProps<Polyline> {
 	public:
-		void Render(std::ostream& os) const override {
+		void Render(Output& os) const {
 			//LOG_PROFILE("Render::Polyline");
 			os << "<polyline ";
-			os << "points=\\\"";
+			os << "points=\"";
 			for (const auto& p : points)
 				os << p.x << "," << p.y << " ";
-			os << "\\\" ";
-			RenderProperties(os);
+			os << "\" ";
+			if (RenderClass(os) == false)
+				RenderProperties(os);
 			os << "/>";
 		}
 
@@ -203,6 +324,13 @@ namespace Svg {
 			return *this;
 		}
 
+		Polyline& SetPoints(std::vector<Point> value) {
+			points = std::move(value);
+			return *this;
+		}
+
+		const std::vector<Point>& GetPoints() const { return points; }
+
 	protected:
 		std::vector<Point> points;
 	};
@@ -210,25 +338,36 @@ namespace Svg {
 
 
 
-	class Text : public SvgObject, public ObjectProps<Text> {
+	class Text : public ObjectProps<Text> { //Текст не копируется: строка должна жить, пока документ выводится
 	public:
 
-		void Render(std::ostream& os) const override {
+		void Render(Output& os) const {
 			//LOG_PROFILE("Render::Text");
 			os << "<text ";
-			os << "x=\\\"" << point.x << "\\\" ";
-			os << "y=\\\"" << point.y << "\\\" ";
-			os << "dx=\\\"" << offset.x << "\\\" ";
-			os << "dy=\\\"" << offset.y << "\\\" ";
-			os << "font-size=\\\"" << fontSize << "\\\" ";
-			if (fontFamily)
-				os << "font-family=\\\"" << fontFamily.value() << "\\\" ";
-			if (fontWeight)
-				os << "font-weight=\\\"" << fontWeight.value() << "\\\" ";
-			RenderProperties(os);
+			os << "x=\"" << point.x << "\" ";
+			os << "y=\"" << point.y << "\" ";
+			os << "dx=\"" << offset.x << "\" ";
+			os << "dy=\"" << offset.y << "\" ";
+			if (RenderClass(os) == false) {
+				os << "font-size=\"" << fontSize << "\" ";
+				if (fontFamily.data())
+					os << "font-family=\"" << fontFamily << "\" ";
+				if (fontWeight.data())
+					os << "font-weight=\"" << fontWeight << "\" ";
+				RenderProperties(os);
+			}
 			os << ">" << text << "</text>";
 		}
 
+		void RenderStyle(Output& os) const {
+			os << "font-size:" << fontSize << "px;";
+			if (fontFamily.data())
+				os << "font-family:" << fontFamily << ";";
+			if (fontWeight.data())
+				os << "font-weight:" << fontWeight << ";";
+			ObjectProps::RenderStyle(os);
+		}
+
 		Text& SetPoint(Point point) {
 			this->point = point;
 			return *this;
@@ -241,39 +380,45 @@ namespace Svg {
 			fontSize = size;
 			return *this;
 		}
-		Text& SetFontFamily(const std::string& value) {
+		Text& SetFontFamily(std::string_view value) { //Как и стили линий - вид на строку, живущую дольше объекта
 			fontFamily = value;
 			return *this;
 		}
-		Text& SetData(const std::string& value) {
+		Text& SetData(std::string_view value) { //Не копирует: строка (имя из Parser или из маршрута) должна жить, пока выводится документ
 			text = value;
 			return *this;
 		}
-		Text& SetFontWeight(const std::string& value) {
+		Text& SetFontWeight(std::string_view value) {
 			fontWeight = value;
 			return *this;
 		}
 
+		Point GetPoint() const { return point; }
+		Point GetOffset() const { return offset; }
+		uint32_t GetFontSize() const { return fontSize; }
+		std::string_view GetData() const { return text; }
+
 	protected:
 		Point point;
 		Point offset;
 		uint32_t fontSize = 1;
-		std::optional<std::string> fontFamily;
-		std::string text;
-		std::optional<std::string> fontWeight;
+		std::string_view fontFamily;
+		std::string_view text;
+		std::string_view fontWeight;
 	};
 
 
-	class Rectangle : public SvgObject, public ObjectProps<Text> {
+	class Rectangle : public ObjectProps<Rectangle> {
 	public:
-		void Render(std::ostream& os) const override {
+		void Render(Output& os) const {
 			//LOG_PROFILE("Render::Rectangle");
 			os << "<rect ";
-			os << "x=\\\"" << position.x << "\\\" ";
-			os << "y=\\\"" << position.y << "\\\" ";
-			os << "width=\\\"" << width << "\\\" ";
-			os << "height=\\\"" << height << "\\\" ";
-			RenderProperties(os);
+			os << "x=\"" << position.x << "\" ";
+			os << "y=\"" << position.y << "\" ";
+			os << "width=\"" << width << "\" ";
+			os << "height=\"" << height << "\" ";
+			if (RenderClass(os) == false)
+				RenderProperties(os);
 			os << "/>";
 		}
 
@@ -299,4 +444,100 @@ namespace Svg {
 
 	};
 
+	class Fragment { //Уже отрисованный кусок документа, разделяемый с кэшем
+	public:
+		explicit Fragment(std::shared_ptr<const std::string> bytes) : bytes(std::move(bytes)) {}
+
+		void Render(Output& os) const {
+			os << *bytes;
+		}
+
+	private:
+		std::shared_ptr<const std::string> bytes;
+	};
+
+	using Object = std::variant<Circle, Polyline, Text, Rectangle, Fragment>;
+
+	class Document { //Объекты лежат по значению в одном векторе, вывод без виртуальных вызовов
+	public:
+		template <typename ObjectType>
+		void Add(ObjectType object) {
+			objects.emplace_back(std::move(object));
+		}
+
+		void Append(Document other) {
+			objects.insert(objects.end(), std::make_move_iterator(other.objects.begin()), std::make_move_iterator(other.objects.end()));
+		}
+
+		void Render(Output& os) const {
+			LOG_PROFILE("Render"); //TODO найти способ оптимизации
+			RenderStart(os);
+			RenderObjects(os);
+			RenderEnd(os);
+		}
+
+		void RenderNoStart(Output& os) const {
+			LOG_PROFILE("RenderNoStart");
+			RenderObjects(os);
+			RenderEnd(os);
+		}
+
+		void RenderViewBox(Output& os, Point origin, double width, double height) const {
+			RenderStart(os, origin, width, height);
+			RenderObjects(os);
+			RenderEnd(os);
+		}
+
+		const std::vector<Object>& GetObjects() const { return objects; }
+
+		void RenderNoEnd(Output& os) const {
+			LOG_PROFILE("RenderNoEnd");
+			RenderStart(os);
+			RenderObjects(os);
+		}
+
+		void RenderObjects(Output& os) const { //Только объекты: документ, склеенный из нескольких, обрамляется отдельно
+			for (const auto& object : objects)
+				std::visit([&os](const auto& value) { value.Render(os); }, object);
+		}
+
+		static void RenderStart(Output& os) { //В компактном выводе сразу за открывающим тегом идёт таблица стилей
+			os << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>";
+			os << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">"; 
+			if (os.GetStyles())
+				os.GetStyles()->Render(os);
+		}
+
+		static void RenderStart(Output& os, Point origin, double width, double height) { //Часть холста: viewBox задаёт видимую область, его не округляем
+			os << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>";
+			os << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" viewBox=\"";
+			os.General(origin.x) << " ";
+			os.General(origin.y) << " ";
+			os.General(width) << " ";
+			os.General(height) << "\">";
+			if (os.GetStyles())
+				os.GetStyles()->Render(os);
+		}
+
+		static void RenderEnd(Output& os) {
+			os << "</svg>";
+		}
+
+	private:
+		std::vector<Object> objects;
+	};
+
+	inline void StyleSheet::Add(const Document& doc) {
+		std::pmr::string style;
+		Output os(style, format);
+		for (const auto& object : doc.GetObjects())
+			std::visit([&](const auto& value) {
+				if constexpr (std::is_same_v<std::decay_t<decltype(value)>, Fragment> == false) {
+					style.clear();
+					value.RenderStyle(os);
+					AddStyle(style);
+				}
+			}, object);
+	}
+
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//Потоки создаются один раз на процесс и переиспользуются всеми запросами - и в пакетном, и в потоковом режиме.
+//Задачи - это короткие части одного запроса (слои карты, оси сжатия), а не сами запросы
+class ThreadPool {
+
+public:
+
+    explicit ThreadPool(size_t threads) {
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] { work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+    static ThreadPool& shared() { //Вызывающий поток тоже работает, поэтому рабочих на один меньше, чем ядер
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+
+    //job(0) .. job(count - 1), номера разбирают вызывающий поток и рабочие.
+    //Вызывающий ждёт только задачи, которые уже начались: если все рабочие заняты (вложенный вызов),
+    //он сделает всё сам, а опоздавшие задачи просто завершатся - так пул не может заблокироваться
+    template <typename Job>
+    void parallelFor(size_t count, const Job& job) {
+        if (count == 0)
+            return;
+        auto batch = std::make_shared<Batch>();
+        batch->count = count;
+        batch->job = [&job](size_t i) { job(i); };
+
+        const size_t helpers = std::min(count - 1, workers.size());
+        for (size_t i = 0; i < helpers; ++i)
+            post([batch] {
+                {
+                    std::lock_guard<std::mutex> lock(batch->mutex);
+                    if (batch->closed)
+                        return;
+                    ++batch->active;
+                }
+                batch->run();
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                if (--batch->active == 0)
+                    batch->done.notify_all();
+            });
+
+        batch->run();
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->closed = true;
+        batch->done.wait(lock, [&] { return batch->active == 0; });
+        if (batch->error)
+            std::rethrow_exception(batch->error);
+    }
+
+private:
+
+    struct Batch {
+        std::function<void(size_t)> job; //Ссылается на стек вызывающего, живого, пока active не 0
+        size_t count = 0;
+        std::atomic<size_t> next{0};
+
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t active = 0;
+        bool closed = false;
+        std::exception_ptr error;
+
+        void run() {
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    job(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (error == nullptr)
+                        error = std::current_exception();
+                }
+            }
+        }
+    };
+
+
+    void post(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wakeUp.notify_one();
+    }
+
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this] { return stopping || tasks.empty() == false; });
+                if (tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+};